@@ -0,0 +1,247 @@
+#ifndef BLOCKSTORAGE_H
+#define BLOCKSTORAGE_H
+
+#include "Block.h"
+#include "SlabAllocator.h"
+
+#include <cstdint>
+#include <stdlib.h>
+#include <string.h>
+#include <vector>
+
+/*
+    Palette compressed block storage for VOXEL_COUNT blocks.
+
+    Every distinct block in the chunk gets one entry in a small palette and
+    each voxel only stores its palette index, bit packed into 64-bit words at
+    0, 1, 2, 4 or 8 bits per voxel depending on the palette size. Indices never
+    straddle two words. With a single palette entry (all air, all stone...)
+    there are no index words at all.
+*/
+template <int VOXEL_COUNT> struct BlockStorage {
+    std::vector<Block> palette; // at most 256 entries (8 bits per voxel)
+
+    BlockStorage();
+    ~BlockStorage();
+    BlockStorage(const BlockStorage &) = delete;
+    BlockStorage &operator=(const BlockStorage &) = delete;
+
+    inline bool isUniform() const { return bitsPerBlock == 0; }
+
+    inline int getPaletteIndex(int index) const {
+        if (bitsPerBlock == 0) {
+            return 0;
+        }
+        uint64_t word = words[index >> blocksPerWordShift];
+        int shift = (index & (blocksPerWord - 1)) * bitsPerBlock;
+        return (int)((word >> shift) & indexMask);
+    }
+
+    inline const Block &get(int index) const {
+        return palette[getPaletteIndex(index)];
+    }
+
+    void set(int index, const Block &block);
+    void fill(const Block *blocks);
+    void unpack(uint8_t *indices) const;
+    size_t getMemoryUsage() const;
+    int getBitsPerBlock() const { return bitsPerBlock; }
+
+    // air is air whatever its blockType says
+    static inline bool isSameBlock(const Block &a, const Block &b) {
+        return a.isActive == b.isActive &&
+               (!a.isActive || a.blockType == b.blockType);
+    }
+
+  private:
+    uint64_t *words;
+    int bitsPerBlock;
+    int blocksPerWord;
+    int blocksPerWordShift;
+    uint64_t indexMask;
+
+    int findOrAddPalette(const Block &block);
+    void setBitsPerBlock(int bits);
+    static int getBitsForPaletteSize(int size);
+
+    // index words come from SlabAllocator, zeroed
+    static uint64_t *allocateWords(int bits);
+    static void freeWords(uint64_t *oldWords, int bits);
+};
+
+template <int VOXEL_COUNT> BlockStorage<VOXEL_COUNT>::BlockStorage() {
+    Block air;
+    air.isActive = false;
+    air.blockType = BlockType::Default;
+    palette.push_back(air);
+    words = nullptr;
+    bitsPerBlock = 0;
+    blocksPerWord = 0;
+    blocksPerWordShift = 0;
+    indexMask = 0;
+}
+
+template <int VOXEL_COUNT> BlockStorage<VOXEL_COUNT>::~BlockStorage() {
+    freeWords(words, bitsPerBlock);
+}
+
+template <int VOXEL_COUNT>
+uint64_t *BlockStorage<VOXEL_COUNT>::allocateWords(int bits) {
+    size_t bytes = ((size_t)VOXEL_COUNT * bits + 63) / 64 * sizeof(uint64_t);
+    uint64_t *newWords = (uint64_t *)SlabAllocator::allocate(bytes);
+    memset(newWords, 0, bytes);
+    return newWords;
+}
+
+template <int VOXEL_COUNT>
+void BlockStorage<VOXEL_COUNT>::freeWords(uint64_t *oldWords, int bits) {
+    if (oldWords != nullptr) {
+        SlabAllocator::deallocate(oldWords, ((size_t)VOXEL_COUNT * bits + 63) /
+                                                64 * sizeof(uint64_t));
+    }
+}
+
+// smallest of 0, 1, 2, 4 and 8 bits that can index size palette entries
+template <int VOXEL_COUNT>
+int BlockStorage<VOXEL_COUNT>::getBitsForPaletteSize(int size) {
+    int bits = 0;
+    while ((1 << bits) < size) {
+        bits = bits == 0 ? 1 : bits * 2;
+    }
+    return bits;
+}
+
+// repack the indices at a new width, keeping every block
+template <int VOXEL_COUNT>
+void BlockStorage<VOXEL_COUNT>::setBitsPerBlock(int bits) {
+    if (bits == bitsPerBlock) {
+        return;
+    }
+
+    uint64_t *newWords = nullptr;
+    int newBlocksPerWord = 0;
+    int newShift = 0;
+    if (bits > 0) {
+        newBlocksPerWord = 64 / bits;
+        while ((1 << newShift) < newBlocksPerWord) {
+            newShift++;
+        }
+        newWords = allocateWords(bits);
+        for (int i = 0; i < VOXEL_COUNT; i++) {
+            uint64_t paletteIndex = getPaletteIndex(i);
+            newWords[i >> newShift] |= paletteIndex
+                                       << ((i & (newBlocksPerWord - 1)) * bits);
+        }
+    }
+
+    freeWords(words, bitsPerBlock);
+    words = newWords;
+    bitsPerBlock = bits;
+    blocksPerWord = newBlocksPerWord;
+    blocksPerWordShift = newShift;
+    indexMask = bits > 0 ? (1ull << bits) - 1 : 0;
+}
+
+template <int VOXEL_COUNT>
+int BlockStorage<VOXEL_COUNT>::findOrAddPalette(const Block &block) {
+    for (size_t i = 0; i < palette.size(); i++) {
+        if (isSameBlock(palette[i], block)) {
+            return (int)i;
+        }
+    }
+    palette.push_back(block);
+    setBitsPerBlock(getBitsForPaletteSize((int)palette.size()));
+    return (int)palette.size() - 1;
+}
+
+// NOTE: the palette only grows here, fill() rebuilds it from scratch
+template <int VOXEL_COUNT>
+void BlockStorage<VOXEL_COUNT>::set(int index, const Block &block) {
+    int paletteIndex = findOrAddPalette(block);
+    if (bitsPerBlock == 0) {
+        return;
+    }
+    uint64_t &word = words[index >> blocksPerWordShift];
+    int shift = (index & (blocksPerWord - 1)) * bitsPerBlock;
+    word = (word & ~(indexMask << shift)) |
+           ((uint64_t)paletteIndex << shift);
+}
+
+// replace the whole volume with a dense array of blocks, building the
+// smallest palette that covers it
+template <int VOXEL_COUNT>
+void BlockStorage<VOXEL_COUNT>::fill(const Block *blocks) {
+    static thread_local std::vector<uint8_t> indices(VOXEL_COUNT);
+
+    palette.clear();
+    palette.push_back(blocks[0]);
+    int last = 0;
+    for (int i = 0; i < VOXEL_COUNT; i++) {
+        // runs of the same block are the common case
+        if (!isSameBlock(blocks[i], palette[last])) {
+            last = -1;
+            for (size_t p = 0; p < palette.size(); p++) {
+                if (isSameBlock(palette[p], blocks[i])) {
+                    last = (int)p;
+                    break;
+                }
+            }
+            if (last < 0) {
+                palette.push_back(blocks[i]);
+                last = (int)palette.size() - 1;
+            }
+        }
+        indices[i] = (uint8_t)last;
+    }
+
+    freeWords(words, bitsPerBlock);
+    words = nullptr;
+    bitsPerBlock = 0;
+    int bits = getBitsForPaletteSize((int)palette.size());
+    if (bits == 0) {
+        return;
+    }
+
+    blocksPerWord = 64 / bits;
+    blocksPerWordShift = 0;
+    while ((1 << blocksPerWordShift) < blocksPerWord) {
+        blocksPerWordShift++;
+    }
+    words = allocateWords(bits);
+    for (int i = 0; i < VOXEL_COUNT; i++) {
+        words[i >> blocksPerWordShift] |=
+            (uint64_t)indices[i] << ((i & (blocksPerWord - 1)) * bits);
+    }
+    bitsPerBlock = bits;
+    indexMask = (1ull << bits) - 1;
+}
+
+// bulk decode of every palette index, one byte per voxel, a word at a time
+template <int VOXEL_COUNT>
+void BlockStorage<VOXEL_COUNT>::unpack(uint8_t *indices) const {
+    if (bitsPerBlock == 0) {
+        memset(indices, 0, VOXEL_COUNT);
+        return;
+    }
+    int i = 0;
+    for (size_t w = 0; i < VOXEL_COUNT; w++) {
+        uint64_t word = words[w];
+        for (int b = 0; b < blocksPerWord && i < VOXEL_COUNT; b++, i++) {
+            indices[i] = (uint8_t)(word & indexMask);
+            word >>= bitsPerBlock;
+        }
+    }
+}
+
+// bytes held for block data, palette included
+template <int VOXEL_COUNT>
+size_t BlockStorage<VOXEL_COUNT>::getMemoryUsage() const {
+    size_t bytes = sizeof(*this) + palette.capacity() * sizeof(Block);
+    if (bitsPerBlock > 0) {
+        bytes += ((VOXEL_COUNT + blocksPerWord - 1) / blocksPerWord) *
+                 sizeof(uint64_t);
+    }
+    return bytes;
+}
+
+#endif // BLOCKSTORAGE_H
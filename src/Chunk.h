@@ -1,7 +1,17 @@
 #ifndef CHUNK_H
 #define CHUNK_H
 #include "Block.h"
+#include "BlockStorage.h"
 #include "ChunkMesh.h"
+#include "TerrainGenerator.h"
+#include <algorithm>
+#include <atomic>
+#include <bitset>
+#include <cstdint>
+#include <vector>
+#if defined(_MSC_VER)
+#include <intrin.h>
+#endif
 #include <glm/glm.hpp>
 #include <learnopengl/shader_m.h>
 
@@ -9,9 +19,39 @@
         TODO LIST:
         - chunk render func inside our outside? how do we want to style our
    codebase?
-        - chunk unloading?
 */
 
+// index of the lowest set bit, x must not be 0
+static inline int countTrailingZeros(uint64_t x) {
+#if defined(_MSC_VER)
+    unsigned long index;
+    _BitScanForward64(&index, x);
+    return (int)index;
+#else
+    return __builtin_ctzll(x);
+#endif
+}
+
+// number of consecutive set bits starting from the lowest bit
+static inline int countTrailingOnes(uint64_t x) {
+    return x == ~0ull ? 64 : countTrailingZeros(~x);
+}
+
+// smallest number of bits that can hold count distinct values
+constexpr int getBitsForRange(int count) {
+    int bits = 0;
+    while ((1 << bits) < count) {
+        bits++;
+    }
+    return bits;
+}
+
+// chunk edge length in blocks, set at build time with the VOXEL_CHUNK_SIZE
+// cmake option
+#ifndef VOXEL_CHUNK_SIZE
+#define VOXEL_CHUNK_SIZE 16
+#endif
+
 typedef struct VoxelPoint3D {
     int x;
     int y;
@@ -19,12 +59,41 @@ typedef struct VoxelPoint3D {
 } VoxelPoint3d;
 
 struct Chunk {
-    static constexpr int CHUNK_SIZE = 16;
+    static constexpr int CHUNK_SIZE = VOXEL_CHUNK_SIZE;
     static constexpr int CHUNK_SIZE_CUBED =
         CHUNK_SIZE * CHUNK_SIZE * CHUNK_SIZE;
     static bool debugMode;
 
-    Block blocks[CHUNK_SIZE_CUBED];
+    // mesher used by createMesh, switchable at runtime for A/B comparison
+    enum {
+        MESHING_NAIVE = 0, // one quad per exposed block face
+        MESHING_GREEDY,    // merges coplanar faces of the same block type
+        MESHING_BINARY,    // greedy, but on bitmasks of block columns
+        MESHING_MODE_COUNT,
+    };
+    static int meshingMode;
+    static const char *meshingModeNames[MESHING_MODE_COUNT];
+    // same seed and chunk position, same blocks
+    static uint32_t terrainSeed;
+
+    // faces are ordered so that axis = face / 2 and the face points towards
+    // the positive side of that axis when face is odd
+    enum {
+        FACE_X_NEGATIVE = 0,
+        FACE_X_POSITIVE,
+        FACE_Y_NEGATIVE,
+        FACE_Y_POSITIVE,
+        FACE_Z_NEGATIVE,
+        FACE_Z_POSITIVE,
+        FACE_COUNT,
+    };
+
+    // palette compressed, a uniform chunk (all air or all one solid type) is
+    // a single palette entry with no per-block data at all
+    BlockStorage<CHUNK_SIZE_CUBED> blocks;
+    // whether the layer of blocks just outside each face is solid, copied in
+    // from the neighbouring chunks by the ChunkManager before meshing
+    std::bitset<CHUNK_SIZE * CHUNK_SIZE> borders[FACE_COUNT];
     ChunkMesh mesh;
     // ChunkModel model;
     glm::vec3 chunkPosition; // minimum corner of the chunk
@@ -32,26 +101,86 @@ struct Chunk {
 
     Chunk(glm::vec3 position, Shader *shader);
     ~Chunk();
+    // chunks are streamed in and out all the time, they come from a
+    // SlabPool instead of the heap
+    static void *operator new(size_t size);
+    static void operator delete(void *chunk, size_t size);
 
     void createMesh();
+    ChunkMesh buildMesh(int mode);
+    bool uploadMesh(ChunkMesh newMesh);
+    void clearMesh();
+    bool needsMesh() const;
+    int countSolidLayers() const;
     void load();
     void unload();
     void rebuildMesh();
+    void generate();
     void setup();
-    void render(Camera camera);
     // BoundingBox getBoundingBox();
-    void initialize();
+    void initialize(Block *out);
+    void setBlocks(const Block *newBlocks);
+    void setBlock(int x, int y, int z, const Block &block);
     void AddCubeFace(ChunkMesh *mesh, int p1, int p2, int p3, int p4,
                      int *vCount, int *iCount);
     void CreateCube(ChunkMesh *mesh, int blockX, int blockY, int blockZ,
                     float size, int *vCount, int *iCount);
+    void CreateGreedyMesh(ChunkMesh *mesh, int *vCount, int *iCount);
+    void CreateBinaryMesh(ChunkMesh *mesh, int *vCount, int *iCount);
+    void AddQuad(ChunkMesh *mesh, int face, const int min[3], const int max[3],
+                 int blockType, int *vCount, int *iCount);
+    bool isBlockActive(int x, int y, int z) const;
     bool isLoaded();
+    bool isGenerated();
     bool isSetup();
+    size_t getMemoryUsage() const;
+    size_t getGpuMemoryUsage() const;
+    bool loadQueued;
+    bool rebuildQueued;
+    bool meshDropped; // its last mesh didn't fit in the mesh arena
+    uint64_t lastVisibleFrame; // ChunkManager frame it was last rendered in
+    int boundsIndex; // in ChunkManager::chunkRegions, -1 when not drawable
+    // fully solid layers of blocks from the bottom up, the box they fill is
+    // what the chunk hides behind it, see OcclusionCuller
+    int solidLayers;
+
+    // lifecycle, advanced by the ChunkManager as jobs finish. A remesh goes
+    // from UPLOADED back through MESHING and MESHED while the old mesh is
+    // still drawn.
+    enum {
+        STATE_REQUESTED = 0, // known, waiting for a generate job
+        STATE_GENERATING,
+        STATE_GENERATED, // blocks final, waiting for a mesh job
+        STATE_MESHING,
+        STATE_MESHED, // mesh built, waiting for upload on the main thread
+        STATE_UPLOADED,
+        STATE_UNLOADING,
+    };
+    std::atomic<int> state;
+
+    // a mesh for this chunk is being built or waiting for upload
+    inline bool isMeshPending() const {
+        int current = state.load();
+        return current == STATE_MESHING || current == STATE_MESHED;
+    }
 
     inline int getIndex(int x, int y, int z) const {
         return x + y * CHUNK_SIZE + z * CHUNK_SIZE * CHUNK_SIZE;
     }
 
+    inline bool isUniform() const { return blocks.isUniform(); }
+
+    // only meaningful when isUniform()
+    inline const Block &getUniformBlock() const { return blocks.palette[0]; }
+
+    inline const Block &getBlock(int index) const { return blocks.get(index); }
+
+    // index into borders[face] of the block at pos, using the two axes
+    // perpendicular to the face in the same order as the greedy mesher
+    static inline int getBorderIndex(int axis, const int pos[3]) {
+        return pos[(axis + 1) % 3] + pos[(axis + 2) % 3] * CHUNK_SIZE;
+    }
+
     // inline int packVertex(int x, int y, int z, int normal,
     //                       BlockType blockType) const {
     //     int data = 0;
@@ -61,94 +190,294 @@ struct Chunk {
     //     data |= (y & 63) << 6;
     //     data |= (x & 63);
     // }
+
+    // vertex positions run from -hs to CHUNK_SIZE * BLOCK_RENDER_SIZE - hs, each
+    // axis gets just enough bits for that range (6 bits for 16 block chunks)
+    // and the offset keeps it positive. terrain.vert reads both as uniforms.
+    static constexpr int VERTEX_POSITION_BITS =
+        getBitsForRange(CHUNK_SIZE * Block::BLOCK_RENDER_SIZE + 1);
+    static constexpr int VERTEX_POSITION_OFFSET = Block::BLOCK_RENDER_SIZE / 2;
+    static constexpr int VERTEX_POSITION_MASK = (1 << VERTEX_POSITION_BITS) - 1;
+    static constexpr int VERTEX_NORMAL_SHIFT = VERTEX_POSITION_BITS * 3;
+    static constexpr int VERTEX_TYPE_SHIFT = VERTEX_NORMAL_SHIFT + 3;
+    static_assert(CHUNK_SIZE * Block::BLOCK_RENDER_SIZE <= VERTEX_POSITION_MASK,
+                  "vertex position does not fit its packed bits");
+    static_assert((1 << (31 - VERTEX_TYPE_SHIFT)) >= NumTypes,
+                  "block type does not fit the packed vertex");
+
     static inline int packVertex(int x, int y, int z, int normal, int type) {
-        int offset = 16; // Offset to handle negative values
-        return ((x + offset) & 0x3F) | (((y + offset) & 0x3F) << 6) |
-               (((z + offset) & 0x3F) << 12) | ((normal & 0x7) << 18) |
-               ((type & 0x7FF) << 21);
+        constexpr int offset = VERTEX_POSITION_OFFSET; // handle negative values
+        constexpr int mask = VERTEX_POSITION_MASK;
+        return ((x + offset) & mask) |
+               (((y + offset) & mask) << VERTEX_POSITION_BITS) |
+               (((z + offset) & mask) << (VERTEX_POSITION_BITS * 2)) |
+               ((normal & 0x7) << VERTEX_NORMAL_SHIFT) |
+               (type << VERTEX_TYPE_SHIFT);
     }
 
   private:
     bool loaded;
+    std::atomic<bool> generated;
     bool hasSetup;
 };
 
+// worst-case sized array the mesher writes into before the result is
+// copied out at its real size. Each thread keeps one and reuses it for every
+// mesh it builds.
+struct ChunkMeshScratch {
+    static constexpr int MAX_VERTICES = Chunk::CHUNK_SIZE_CUBED * 6 * 4;
+    static constexpr int COLUMN_COUNT = Chunk::CHUNK_SIZE * Chunk::CHUNK_SIZE;
+    static_assert(Chunk::CHUNK_SIZE <= 64,
+                  "binary mesher columns are 64 bit wide");
+
+    int *vertices;
+
+    // binary mesher: occupancy columns along each axis, indexed like
+    // Chunk::borders, and the visible faces of one face direction split by
+    // slice and block type as rows of bits
+    uint64_t *columns[3];
+    uint64_t *planes; // [slice][blockType][row]
+    uint32_t *planeTypes; // bitmask of block types in each slice
+    uint8_t *paletteIndices; // Chunk::blocks unpacked, one byte per block
+
+    ChunkMeshScratch() {
+        vertices = (int *)malloc(MAX_VERTICES * sizeof(int));
+        for (int axis = 0; axis < 3; axis++) {
+            columns[axis] = (uint64_t *)malloc(COLUMN_COUNT * sizeof(uint64_t));
+        }
+        planes = (uint64_t *)malloc(Chunk::CHUNK_SIZE * BlockType::NumTypes *
+                                    Chunk::CHUNK_SIZE * sizeof(uint64_t));
+        planeTypes = (uint32_t *)malloc(Chunk::CHUNK_SIZE * sizeof(uint32_t));
+        paletteIndices = (uint8_t *)malloc(Chunk::CHUNK_SIZE_CUBED);
+    }
+    ~ChunkMeshScratch() {
+        free(vertices);
+        for (int axis = 0; axis < 3; axis++) {
+            free(columns[axis]);
+        }
+        free(planes);
+        free(planeTypes);
+        free(paletteIndices);
+    }
+
+    inline uint64_t *getPlane(int slice, int blockType) {
+        return planes +
+               (slice * BlockType::NumTypes + blockType) * Chunk::CHUNK_SIZE;
+    }
+};
+
+// the calling thread's scratch buffers
+ChunkMeshScratch &GetMeshScratch() {
+    static thread_local ChunkMeshScratch scratch;
+    return scratch;
+}
+
 bool Chunk::debugMode = false;
+int Chunk::meshingMode = Chunk::MESHING_GREEDY;
+const char *Chunk::meshingModeNames[Chunk::MESHING_MODE_COUNT] = {
+    "Naive", "Greedy", "Binary"};
+uint32_t Chunk::terrainSeed = 1337;
 
 Chunk::Chunk(glm::vec3 position, Shader *shader) {
-    // blocks = new Block[CHUNK_SIZE_CUBED];
     chunkPosition = position;
     // material = LoadMaterialDefault();
     material = Material(shader);
     // material.maps[MATERIAL_MAP_DIFFUSE].color.a = 255.0f;
 
+    mesh = ChunkMesh{};
     hasSetup = false;
     loaded = false;
+    generated = false;
+    loadQueued = false;
+    rebuildQueued = false;
+    meshDropped = false;
+    lastVisibleFrame = 0;
+    boundsIndex = -1;
+    solidLayers = 0;
+    state = STATE_REQUESTED;
 };
 
 Chunk::~Chunk(){
-    // delete blocks;
 };
 
-// create vbo to be used to render chunk
-void Chunk::createMesh() {
-    int vertexCount = 0;
-    int indexCount = 0;
+static SlabPool &GetChunkPool() {
+    static SlabPool pool(sizeof(Chunk));
+    return pool;
+}
 
-    int totalVertices = CHUNK_SIZE_CUBED * 6 * 4 * 2;
-    int totalIndices = CHUNK_SIZE_CUBED * 6 * 6 * 2;
+// the pool only holds Chunk sized blocks, anything bigger uses the heap
+void *Chunk::operator new(size_t size) {
+    if (size != sizeof(Chunk)) {
+        return ::operator new(size);
+    }
+    return GetChunkPool().allocate();
+}
 
-    unsigned int *indices =
-        (unsigned int *)malloc(totalIndices * sizeof(unsigned int));
+void Chunk::operator delete(void *chunk, size_t size) {
+    if (size != sizeof(Chunk)) {
+        ::operator delete(chunk);
+        return;
+    }
+    GetChunkPool().deallocate(chunk);
+}
 
-    mesh = {0};
-    mesh.vertexCount = 0;
-    mesh.triangleCount = 0;
-    mesh.vertices = (int *)malloc(totalVertices * sizeof(int));
-    mesh.indices = indices;
+// create vbo to be used to render chunk
+void Chunk::createMesh() {
+    ChunkMesh newMesh = buildMesh(meshingMode);
+    if (!uploadMesh(newMesh)) {
+        FreeChunkMeshData(&newMesh); // no room, keep drawing the old mesh
+    }
+}
 
-    for (int x = 0; x < CHUNK_SIZE; x++) {
-        for (int y = 0; y < CHUNK_SIZE; y++) {
-            for (int z = 0; z < CHUNK_SIZE; z++) {
-                Block &block = blocks[getIndex(x, y, z)];
-                if (!block.isActive) {
-                    continue;
+// build the vertex and index arrays on the CPU only, so this can run on any
+// thread. Reads blocks and borders, which must not change until it returns.
+ChunkMesh Chunk::buildMesh(int mode) {
+    ChunkMeshScratch &scratch = GetMeshScratch();
+    int indexCount = 0;
+
+    ChunkMesh newMesh = {};
+    newMesh.vertexCount = 0;
+    newMesh.triangleCount = 0;
+    newMesh.vertices = scratch.vertices;
+
+    if (mode == MESHING_GREEDY) {
+        CreateGreedyMesh(&newMesh, &newMesh.vertexCount, &indexCount);
+    } else if (mode == MESHING_BINARY) {
+        CreateBinaryMesh(&newMesh, &newMesh.vertexCount, &indexCount);
+    } else {
+        for (int x = 0; x < CHUNK_SIZE; x++) {
+            for (int y = 0; y < CHUNK_SIZE; y++) {
+                for (int z = 0; z < CHUNK_SIZE; z++) {
+                    const Block &block = getBlock(getIndex(x, y, z));
+                    if (!block.isActive) {
+                        continue;
+                    }
+                    CreateCube(&newMesh, x, y, z, Block::BLOCK_RENDER_SIZE,
+                               &newMesh.vertexCount, &indexCount);
                 }
-                CreateCube(&mesh, x, y, z, Block::BLOCK_RENDER_SIZE,
-                           &mesh.vertexCount, &indexCount);
             }
         }
     }
 
-    mesh.triangleCount = indexCount / 3;
-    UploadChunkMesh(&mesh, false);
+    newMesh.triangleCount = indexCount / 3;
+
+    // hand back a copy of exactly the size used, the scratch stays with us
+    newMesh.vertices = NULL;
+    if (newMesh.vertexCount > 0) {
+        newMesh.vertices = (int *)SlabAllocator::allocate(
+            newMesh.vertexCount * sizeof(int));
+        memcpy(newMesh.vertices, scratch.vertices,
+               newMesh.vertexCount * sizeof(int));
+    }
+    return newMesh;
+}
+
+// swap in a mesh from buildMesh, must be called on the thread owning the GL
+// context. Returns false if the mesh arena is full: the chunk keeps its old
+// mesh and newMesh keeps its data, so the upload can be tried again.
+bool Chunk::uploadMesh(ChunkMesh newMesh) {
+    if (newMesh.vertexCount == 0) {
+        clearMesh();
+        return true;
+    }
+    if (!UploadChunkMesh(&newMesh, chunkPosition)) {
+        return false;
+    }
+    if (mesh.arenaPageCount > 0) {
+        UnloadChunkMesh(mesh);
+    }
+    mesh = newMesh;
+    // the GPU has its own copy now and remeshing starts again from the blocks
+    FreeChunkMeshData(&mesh);
+    hasSetup = true;
     // model = LoadChunkModelFromMesh(mesh, material);
     // model = LoadModelFromMesh(mesh);
+    return true;
+}
+
+// for chunks with nothing to draw: no mesh and no arena pages at all
+void Chunk::clearMesh() {
+    if (mesh.arenaPageCount > 0) {
+        UnloadChunkMesh(mesh);
+    }
+    mesh = ChunkMesh{};
+    hasSetup = true;
+}
+
+// uniform chunks can tell without meshing: all air never has faces and all
+// solid only has faces where a neighbouring layer is not solid
+bool Chunk::needsMesh() const {
+    if (!isUniform()) {
+        return true;
+    }
+    if (!getUniformBlock().isActive) {
+        return false;
+    }
+    for (int face = 0; face < FACE_COUNT; face++) {
+        if (!borders[face].all()) {
+            return true;
+        }
+    }
+    return false;
+}
+
+// how many y layers from the bottom have every block solid
+int Chunk::countSolidLayers() const {
+    if (isUniform()) {
+        return getUniformBlock().isActive ? CHUNK_SIZE : 0;
+    }
+    for (int y = 0; y < CHUNK_SIZE; y++) {
+        for (int z = 0; z < CHUNK_SIZE; z++) {
+            for (int x = 0; x < CHUNK_SIZE; x++) {
+                if (!getBlock(getIndex(x, y, z)).isActive) {
+                    return y;
+                }
+            }
+        }
+    }
+    return CHUNK_SIZE;
 }
 
 void Chunk::load() { loaded = true; }
 
 void Chunk::unload() {
     // UnloadModel(model);
-    UnloadChunkMesh(mesh);
+    if (mesh.arenaPageCount > 0) {
+        UnloadChunkMesh(mesh);
+    }
+    mesh = ChunkMesh{};
     loaded = false;
     hasSetup = false;
 }
 
-void Chunk::rebuildMesh() {
-    UnloadChunkMesh(mesh);
-    createMesh();
+void Chunk::rebuildMesh() { createMesh(); }
+
+// fill in the blocks, neighbours can read them once this is done
+void Chunk::generate() {
+    static thread_local std::vector<Block> scratch(CHUNK_SIZE_CUBED);
+    initialize(scratch.data());
+    setBlocks(scratch.data());
+    generated = true;
+}
+
+// replace every block, packing them into the smallest palette that fits
+void Chunk::setBlocks(const Block *newBlocks) { blocks.fill(newBlocks); }
+
+// edit a single block, a uniform chunk gets per-block storage from here on.
+// Only call this on the main thread while no mesh is being built
+// (isMeshPending), then queue the chunk and its neighbours for a rebuild.
+void Chunk::setBlock(int x, int y, int z, const Block &block) {
+    blocks.set(getIndex(x, y, z), block);
 }
 
 void Chunk::setup() {
-    initialize();
+    if (!generated) {
+        generate();
+    }
     createMesh();
     hasSetup = true;
 }
 
-// renders the chunk
-void Chunk::render(Camera camera) { DrawChunkMesh(camera, mesh, material, chunkPosition); }
-
 // BoundingBox Chunk::getBoundingBox() {
 //     glm::vec3 max = {chunkPosition.x + CHUNK_SIZE * Block::BLOCK_RENDER_SIZE,
 //                      chunkPosition.y + CHUNK_SIZE * Block::BLOCK_RENDER_SIZE,
@@ -158,19 +487,14 @@ void Chunk::render(Camera camera) { DrawChunkMesh(camera, mesh, material, chunkP
 //     return bBox;
 // }
 
-void Chunk::initialize() {
-    for (int x = 0; x < CHUNK_SIZE; x++) {
-        for (int y = 0; y < CHUNK_SIZE; y++) {
-            for (int z = 0; z < CHUNK_SIZE; z++) {
-                int index = getIndex(x, y, z);
-                // NOTE: there seems to be a "pattern" in some chunks - is the same seed be initted across threads?
-                // seems like it does: https://en.cppreference.com/w/cpp/numeric/random/rand
-                blocks[index].isActive = (std::rand() % 2 == 0) ? false : true;
-                blocks[index].blockType = (std::rand() % 2 == 0) ? BlockType::Grass : BlockType::Sand;
-                // blocks[index].isActive = true;
-            }
-        }
-    }
+// deterministic for a given terrainSeed and chunk position, safe to call
+// from any thread
+void Chunk::initialize(Block *out) {
+    TerrainGenerator generator(terrainSeed);
+    generator.generateChunk<CHUNK_SIZE>(
+        (int)std::floor(chunkPosition.x / Block::BLOCK_RENDER_SIZE),
+        (int)std::floor(chunkPosition.y / Block::BLOCK_RENDER_SIZE),
+        (int)std::floor(chunkPosition.z / Block::BLOCK_RENDER_SIZE), out);
 }
 
 // void deactivateBlock(Vector2 coords) {
@@ -189,13 +513,7 @@ void Chunk::AddCubeFace(ChunkMesh *mesh, int p1, int p2, int p3, int p4,
     mesh->vertices[v3] = p3;
     mesh->vertices[v4] = p4;
 
-    // Add indices
-    mesh->indices[*iCount] = v1;
-    mesh->indices[*iCount + 1] = v2;
-    mesh->indices[*iCount + 2] = v3;
-    mesh->indices[*iCount + 3] = v1;
-    mesh->indices[*iCount + 4] = v3;
-    mesh->indices[*iCount + 5] = v4;
+    // Indices come from the shared quad index buffer, just count them
 
     *vCount += 4;
     *iCount += 6;
@@ -207,7 +525,7 @@ void Chunk::CreateCube(ChunkMesh *mesh, int blockX, int blockY, int blockZ,
 
     // TODO: casts here?
     // TODO: ignore normals for now
-    BlockType blockType = blocks[getIndex(blockX, blockY, blockZ)].blockType;
+    BlockType blockType = getBlock(getIndex(blockX, blockY, blockZ)).blockType;
     int p1 = Chunk::packVertex(Block::BLOCK_RENDER_SIZE * blockX - hs,
                                Block::BLOCK_RENDER_SIZE * blockY - hs,
                                Block::BLOCK_RENDER_SIZE * blockZ + hs, 1,
@@ -241,25 +559,13 @@ void Chunk::CreateCube(ChunkMesh *mesh, int blockX, int blockY, int blockZ,
                                Block::BLOCK_RENDER_SIZE * blockZ - hs, 1,
                                blockType);
 
-    bool lDefault = false;
-    bool lXNegative = lDefault;
-    if (blockX > 0)
-        lXNegative = blocks[getIndex(blockX - 1, blockY, blockZ)].isActive;
-    bool lXPositive = lDefault;
-    if (blockX < CHUNK_SIZE - 1)
-        lXPositive = blocks[getIndex(blockX + 1, blockY, blockZ)].isActive;
-    bool lYNegative = lDefault;
-    if (blockY > 0)
-        lYNegative = blocks[getIndex(blockX, blockY - 1, blockZ)].isActive;
-    bool lYPositive = lDefault;
-    if (blockY < CHUNK_SIZE - 1)
-        lYPositive = blocks[getIndex(blockX, blockY + 1, blockZ)].isActive;
-    bool lZNegative = lDefault;
-    if (blockZ > 0)
-        lZNegative = blocks[getIndex(blockX, blockY, blockZ - 1)].isActive;
-    bool lZPositive = lDefault;
-    if (blockZ < CHUNK_SIZE - 1)
-        lZPositive = blocks[getIndex(blockX, blockY, blockZ + 1)].isActive;
+    // neighbours across the chunk border come from the borders masks
+    bool lXNegative = isBlockActive(blockX - 1, blockY, blockZ);
+    bool lXPositive = isBlockActive(blockX + 1, blockY, blockZ);
+    bool lYNegative = isBlockActive(blockX, blockY - 1, blockZ);
+    bool lYPositive = isBlockActive(blockX, blockY + 1, blockZ);
+    bool lZNegative = isBlockActive(blockX, blockY, blockZ - 1);
+    bool lZPositive = isBlockActive(blockX, blockY, blockZ + 1);
 
     glm::vec3 n1 = {0.0f, 0.0f, 1.0f};
     if (!lZPositive) {
@@ -292,8 +598,256 @@ void Chunk::CreateCube(ChunkMesh *mesh, int blockX, int blockY, int blockZ,
     }
 }
 
+// blocks one step outside of the chunk are looked up in the borders masks
+bool Chunk::isBlockActive(int x, int y, int z) const {
+    int pos[3] = {x, y, z};
+    for (int axis = 0; axis < 3; axis++) {
+        if (pos[axis] < 0) {
+            return borders[axis * 2][getBorderIndex(axis, pos)];
+        }
+        if (pos[axis] >= CHUNK_SIZE) {
+            return borders[axis * 2 + 1][getBorderIndex(axis, pos)];
+        }
+    }
+    return getBlock(getIndex(x, y, z)).isActive;
+}
+
+// adds a single quad covering the given face of the block range [min, max]
+void Chunk::AddQuad(ChunkMesh *mesh, int face, const int min[3],
+                    const int max[3], int blockType, int *vCount, int *iCount) {
+    // which corner (0 = min, 1 = max) each vertex takes on each axis, in the
+    // same winding order that CreateCube uses
+    static constexpr int corners[FACE_COUNT][4][3] = {
+        {{0, 0, 0}, {0, 0, 1}, {0, 1, 1}, {0, 1, 0}}, // x-
+        {{1, 0, 1}, {1, 0, 0}, {1, 1, 0}, {1, 1, 1}}, // x+
+        {{0, 0, 0}, {1, 0, 0}, {1, 0, 1}, {0, 0, 1}}, // y-
+        {{0, 1, 1}, {1, 1, 1}, {1, 1, 0}, {0, 1, 0}}, // y+
+        {{1, 0, 0}, {0, 0, 0}, {0, 1, 0}, {1, 1, 0}}, // z-
+        {{0, 0, 1}, {1, 0, 1}, {1, 1, 1}, {0, 1, 1}}, // z+
+    };
+    int hs = Block::BLOCK_RENDER_SIZE / 2;
+
+    int p[4];
+    for (int i = 0; i < 4; i++) {
+        int pos[3];
+        for (int axis = 0; axis < 3; axis++) {
+            pos[axis] = corners[face][i][axis]
+                            ? Block::BLOCK_RENDER_SIZE * max[axis] + hs
+                            : Block::BLOCK_RENDER_SIZE * min[axis] - hs;
+        }
+        p[i] = Chunk::packVertex(pos[0], pos[1], pos[2], 1, blockType);
+    }
+    AddCubeFace(mesh, p[0], p[1], p[2], p[3], vCount, iCount);
+}
+
+// greedy meshing: for every slice of every face direction, build a mask of
+// the exposed faces and merge runs of the same block type into rectangles
+void Chunk::CreateGreedyMesh(ChunkMesh *mesh, int *vCount, int *iCount) {
+    // blockType + 1 of the exposed face at each cell, 0 when there is none
+    int mask[CHUNK_SIZE * CHUNK_SIZE];
+
+    for (int face = 0; face < FACE_COUNT; face++) {
+        int axis = face / 2;
+        int u = (axis + 1) % 3;
+        int v = (axis + 2) % 3;
+        int dir = (face % 2 == 0) ? -1 : 1;
+
+        for (int slice = 0; slice < CHUNK_SIZE; slice++) {
+            for (int j = 0; j < CHUNK_SIZE; j++) {
+                for (int i = 0; i < CHUNK_SIZE; i++) {
+                    int pos[3];
+                    pos[axis] = slice;
+                    pos[u] = i;
+                    pos[v] = j;
+                    const Block &block =
+                        getBlock(getIndex(pos[0], pos[1], pos[2]));
+                    int cell = 0;
+                    if (block.isActive) {
+                        pos[axis] += dir;
+                        if (!isBlockActive(pos[0], pos[1], pos[2])) {
+                            cell = block.blockType + 1;
+                        }
+                    }
+                    mask[i + j * CHUNK_SIZE] = cell;
+                }
+            }
+
+            for (int j = 0; j < CHUNK_SIZE; j++) {
+                for (int i = 0; i < CHUNK_SIZE;) {
+                    int cell = mask[i + j * CHUNK_SIZE];
+                    if (cell == 0) {
+                        i++;
+                        continue;
+                    }
+
+                    int width = 1;
+                    while (i + width < CHUNK_SIZE &&
+                           mask[i + width + j * CHUNK_SIZE] == cell) {
+                        width++;
+                    }
+
+                    int height = 1;
+                    for (; j + height < CHUNK_SIZE; height++) {
+                        bool rowMatches = true;
+                        for (int k = 0; k < width; k++) {
+                            if (mask[i + k + (j + height) * CHUNK_SIZE] !=
+                                cell) {
+                                rowMatches = false;
+                                break;
+                            }
+                        }
+                        if (!rowMatches) {
+                            break;
+                        }
+                    }
+
+                    int min[3], max[3];
+                    min[axis] = max[axis] = slice;
+                    min[u] = i;
+                    max[u] = i + width - 1;
+                    min[v] = j;
+                    max[v] = j + height - 1;
+                    AddQuad(mesh, face, min, max, cell - 1, vCount, iCount);
+
+                    for (int h = 0; h < height; h++) {
+                        for (int k = 0; k < width; k++) {
+                            mask[i + k + (j + h) * CHUNK_SIZE] = 0;
+                        }
+                    }
+                    i += width;
+                }
+            }
+        }
+    }
+}
+
+// binary meshing: pack the chunk into 64 bit occupancy columns along each
+// axis, find every visible face of a column with a shift and a mask, then
+// greedily merge the faces of each slice a row of bits at a time
+void Chunk::CreateBinaryMesh(ChunkMesh *mesh, int *vCount, int *iCount) {
+    ChunkMeshScratch &scratch = GetMeshScratch();
+    constexpr int N = CHUNK_SIZE;
+    constexpr uint64_t rowMask = N == 64 ? ~0ull : (1ull << N) - 1;
+
+    // palette lookups are done once per palette entry, not once per block
+    uint64_t paletteActive[256];
+    int paletteType[256];
+    for (size_t i = 0; i < blocks.palette.size(); i++) {
+        paletteActive[i] = blocks.palette[i].isActive ? 1 : 0;
+        paletteType[i] = blocks.palette[i].blockType;
+    }
+
+    for (int axis = 0; axis < 3; axis++) {
+        uint64_t fill = isUniform() && paletteActive[0] ? rowMask : 0;
+        std::fill(scratch.columns[axis],
+                  scratch.columns[axis] + ChunkMeshScratch::COLUMN_COUNT, fill);
+    }
+    if (!isUniform()) {
+        blocks.unpack(scratch.paletteIndices);
+        for (int z = 0; z < N; z++) {
+            for (int y = 0; y < N; y++) {
+                for (int x = 0; x < N; x++) {
+                    uint64_t active =
+                        paletteActive[scratch.paletteIndices[getIndex(x, y, z)]];
+                    scratch.columns[0][y + z * N] |= active << x;
+                    scratch.columns[1][z + x * N] |= active << y;
+                    scratch.columns[2][x + y * N] |= active << z;
+                }
+            }
+        }
+    } else {
+        memset(scratch.paletteIndices, 0, CHUNK_SIZE_CUBED);
+    }
+
+    for (int face = 0; face < FACE_COUNT; face++) {
+        int axis = face / 2;
+        int u = (axis + 1) % 3;
+        int v = (axis + 2) % 3;
+        bool positive = face % 2 == 1;
+
+        memset(scratch.planeTypes, 0, N * sizeof(uint32_t));
+        memset(scratch.planes, 0,
+               N * BlockType::NumTypes * N * sizeof(uint64_t));
+
+        // a face is visible where the next block along the face normal is
+        // empty, which for a whole column is one shift, the chunk border
+        // supplies the bit shifted in from outside
+        for (int column = 0; column < ChunkMeshScratch::COLUMN_COUNT;
+             column++) {
+            uint64_t bits = scratch.columns[axis][column];
+            if (bits == 0) {
+                continue;
+            }
+            uint64_t border = borders[face][column] ? 1 : 0;
+            uint64_t covered = positive ? (bits >> 1) | (border << (N - 1))
+                                        : (bits << 1) | border;
+            uint64_t visible = bits & ~covered & rowMask;
+
+            int pos[3];
+            pos[u] = column % N;
+            pos[v] = column / N;
+            while (visible != 0) {
+                int slice = countTrailingZeros(visible);
+                visible &= visible - 1;
+                pos[axis] = slice;
+                int blockType = paletteType
+                    [scratch.paletteIndices[getIndex(pos[0], pos[1], pos[2])]];
+                scratch.getPlane(slice, blockType)[pos[v]] |= 1ull << pos[u];
+                scratch.planeTypes[slice] |= 1u << blockType;
+            }
+        }
+
+        for (int slice = 0; slice < N; slice++) {
+            uint32_t types = scratch.planeTypes[slice];
+            while (types != 0) {
+                int blockType = countTrailingZeros(types);
+                types &= types - 1;
+                uint64_t *rows = scratch.getPlane(slice, blockType);
+
+                for (int j = 0; j < N; j++) {
+                    while (rows[j] != 0) {
+                        int i = countTrailingZeros(rows[j]);
+                        int width = countTrailingOnes(rows[j] >> i);
+                        uint64_t run =
+                            (width == 64 ? ~0ull : (1ull << width) - 1) << i;
+                        rows[j] &= ~run;
+
+                        int height = 1;
+                        while (j + height < N &&
+                               (rows[j + height] & run) == run) {
+                            rows[j + height] &= ~run;
+                            height++;
+                        }
+
+                        int min[3], max[3];
+                        min[axis] = max[axis] = slice;
+                        min[u] = i;
+                        max[u] = i + width - 1;
+                        min[v] = j;
+                        max[v] = j + height - 1;
+                        AddQuad(mesh, face, min, max, blockType, vCount,
+                                iCount);
+                    }
+                }
+            }
+        }
+    }
+}
+
 bool Chunk::isLoaded() { return loaded; }
 
+bool Chunk::isGenerated() { return generated; }
+
 bool Chunk::isSetup() { return hasSetup; }
 
+// the Chunk object and its block storage
+size_t Chunk::getMemoryUsage() const {
+    return sizeof(Chunk) - sizeof(blocks) + blocks.getMemoryUsage();
+}
+
+// the MeshArena pages of the uploaded mesh, the quad index buffer is shared
+size_t Chunk::getGpuMemoryUsage() const {
+    return (size_t)mesh.arenaPageCount * MeshArena::PAGE_VERTICES * sizeof(int);
+}
+
 #endif // CHUNK_H
@@ -0,0 +1,341 @@
+#ifndef CHUNKBOUNDS_H
+#define CHUNKBOUNDS_H
+
+#include "ChunkMap.h"
+#include "Frustum.h"
+
+#include <cmath>
+#include <glm/glm.hpp>
+#include <unordered_map>
+#include <vector>
+
+#if defined(__SSE__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 1)
+#include <xmmintrin.h>
+#define CHUNKBOUNDS_SSE 1
+#endif
+
+struct Chunk;
+
+/*
+    Bounds of every chunk that has something to draw, one array per
+    coordinate so the frustum test runs on four chunks at once.
+
+    A box is outside the frustum when its corner furthest along a plane's
+    normal (the p-vertex) is behind that plane, which is the same answer as
+    testing all eight corners, with one dot product per plane.
+
+    Entries are removed by moving the last one into the hole, so an index
+    only stays valid until the next remove. The owner keeps each chunk's
+    index (Chunk::boundsIndex) and fixes up the one remove() moved.
+*/
+struct ChunkBoundsTable {
+    // returns the chunk's index
+    int add(Chunk *chunk, glm::vec3 min, glm::vec3 max);
+    // returns the chunk that took over index, or nullptr if it was the last
+    Chunk *remove(int index);
+    void clear();
+    size_t size() const { return chunks.size(); }
+
+    // append the chunks whose min corner is within [rangeMin, rangeMax] and
+    // whose box is not outside frustum to visible
+    void cull(const Frustum &frustum, glm::vec3 rangeMin, glm::vec3 rangeMax,
+              std::vector<Chunk *> &visible) const;
+    // append every chunk without testing it
+    void appendAll(std::vector<Chunk *> &visible) const {
+        visible.insert(visible.end(), chunks.begin(), chunks.end());
+    }
+
+  private:
+    std::vector<float> minX, minY, minZ;
+    std::vector<float> maxX, maxY, maxZ;
+    std::vector<Chunk *> chunks;
+
+    bool isVisible(size_t i, const Frustum &frustum, glm::vec3 rangeMin,
+                   glm::vec3 rangeMax) const;
+};
+
+int ChunkBoundsTable::add(Chunk *chunk, glm::vec3 min, glm::vec3 max) {
+    minX.push_back(min.x);
+    minY.push_back(min.y);
+    minZ.push_back(min.z);
+    maxX.push_back(max.x);
+    maxY.push_back(max.y);
+    maxZ.push_back(max.z);
+    chunks.push_back(chunk);
+    return (int)chunks.size() - 1;
+}
+
+Chunk *ChunkBoundsTable::remove(int index) {
+    size_t last = chunks.size() - 1;
+    Chunk *moved = nullptr;
+    if ((size_t)index != last) {
+        minX[index] = minX[last];
+        minY[index] = minY[last];
+        minZ[index] = minZ[last];
+        maxX[index] = maxX[last];
+        maxY[index] = maxY[last];
+        maxZ[index] = maxZ[last];
+        chunks[index] = chunks[last];
+        moved = chunks[index];
+    }
+    minX.pop_back();
+    minY.pop_back();
+    minZ.pop_back();
+    maxX.pop_back();
+    maxY.pop_back();
+    maxZ.pop_back();
+    chunks.pop_back();
+    return moved;
+}
+
+void ChunkBoundsTable::clear() {
+    minX.clear();
+    minY.clear();
+    minZ.clear();
+    maxX.clear();
+    maxY.clear();
+    maxZ.clear();
+    chunks.clear();
+}
+
+// one entry at a time, for the tail the four wide loop leaves over
+bool ChunkBoundsTable::isVisible(size_t i, const Frustum &frustum,
+                                 glm::vec3 rangeMin, glm::vec3 rangeMax) const {
+    if (minX[i] < rangeMin.x || minX[i] > rangeMax.x || minY[i] < rangeMin.y ||
+        minY[i] > rangeMax.y || minZ[i] < rangeMin.z || minZ[i] > rangeMax.z) {
+        return false;
+    }
+    for (int p = 0; p < 6; p++) {
+        const Plane3 &plane = frustum.planes[p];
+        glm::vec3 farthest(plane.normal.x > 0 ? maxX[i] : minX[i],
+                           plane.normal.y > 0 ? maxY[i] : minY[i],
+                           plane.normal.z > 0 ? maxZ[i] : minZ[i]);
+        if (plane.GetPointDistance(farthest) < 0) {
+            return false;
+        }
+    }
+    return true;
+}
+
+void ChunkBoundsTable::cull(const Frustum &frustum, glm::vec3 rangeMin,
+                            glm::vec3 rangeMax,
+                            std::vector<Chunk *> &visible) const {
+    size_t count = chunks.size();
+    size_t i = 0;
+#ifdef CHUNKBOUNDS_SSE
+    const __m128 rangeMinX = _mm_set1_ps(rangeMin.x);
+    const __m128 rangeMinY = _mm_set1_ps(rangeMin.y);
+    const __m128 rangeMinZ = _mm_set1_ps(rangeMin.z);
+    const __m128 rangeMaxX = _mm_set1_ps(rangeMax.x);
+    const __m128 rangeMaxY = _mm_set1_ps(rangeMax.y);
+    const __m128 rangeMaxZ = _mm_set1_ps(rangeMax.z);
+    const __m128 zero = _mm_setzero_ps();
+    for (; i + 4 <= count; i += 4) {
+        __m128 x0 = _mm_loadu_ps(&minX[i]);
+        __m128 y0 = _mm_loadu_ps(&minY[i]);
+        __m128 z0 = _mm_loadu_ps(&minZ[i]);
+        __m128 x1 = _mm_loadu_ps(&maxX[i]);
+        __m128 y1 = _mm_loadu_ps(&maxY[i]);
+        __m128 z1 = _mm_loadu_ps(&maxZ[i]);
+
+        __m128 inside = _mm_and_ps(_mm_cmpge_ps(x0, rangeMinX),
+                                   _mm_cmple_ps(x0, rangeMaxX));
+        inside = _mm_and_ps(inside, _mm_cmpge_ps(y0, rangeMinY));
+        inside = _mm_and_ps(inside, _mm_cmple_ps(y0, rangeMaxY));
+        inside = _mm_and_ps(inside, _mm_cmpge_ps(z0, rangeMinZ));
+        inside = _mm_and_ps(inside, _mm_cmple_ps(z0, rangeMaxZ));
+
+        for (int p = 0; p < 6 && _mm_movemask_ps(inside) != 0; p++) {
+            const Plane3 &plane = frustum.planes[p];
+            // the p-vertex picks the same side of every box for a plane
+            __m128 px = plane.normal.x > 0 ? x1 : x0;
+            __m128 py = plane.normal.y > 0 ? y1 : y0;
+            __m128 pz = plane.normal.z > 0 ? z1 : z0;
+            __m128 distance = _mm_sub_ps(
+                _mm_add_ps(
+                    _mm_add_ps(_mm_mul_ps(px, _mm_set1_ps(plane.normal.x)),
+                               _mm_mul_ps(py, _mm_set1_ps(plane.normal.y))),
+                    _mm_mul_ps(pz, _mm_set1_ps(plane.normal.z))),
+                _mm_set1_ps(plane.distance));
+            inside = _mm_and_ps(inside, _mm_cmpge_ps(distance, zero));
+        }
+
+        int mask = _mm_movemask_ps(inside);
+        for (int lane = 0; lane < 4 && mask != 0; lane++, mask >>= 1) {
+            if (mask & 1) {
+                visible.push_back(chunks[i + lane]);
+            }
+        }
+    }
+#endif
+    for (; i < count; i++) {
+        if (isVisible(i, frustum, rangeMin, rangeMax)) {
+            visible.push_back(chunks[i]);
+        }
+    }
+}
+
+/*
+    The drawable chunks split into regions of REGION_CHUNKS^3 chunks, each
+    with its own ChunkBoundsTable.
+
+    Culling only looks up the regions the range overlaps, and tests each
+    region's box before its chunks: a region outside the frustum is skipped
+    whole, one inside the frustum and the range has all its chunks taken
+    without a test, and only the ones on an edge cull chunk by chunk. The
+    cost follows the render range and what is near the frustum's edges, not
+    how many chunks are loaded.
+
+    Boxes are the chunk grid moved by boundsOffset on every axis, as block
+    geometry is centred on the block positions. Render ranges are given on
+    the grid and moved the same way before testing.
+
+    Index handling is the same as ChunkBoundsTable, the index a chunk gets
+    is into its region's table.
+*/
+struct ChunkRegionGrid {
+    static constexpr int REGION_SHIFT = 2;
+    static constexpr int REGION_CHUNKS = 1 << REGION_SHIFT; // per axis
+
+    ChunkRegionGrid(float _chunkSize, float _boundsOffset)
+        : chunkSize(_chunkSize), boundsOffset(_boundsOffset) {}
+
+    // chunk at chunk coordinates coords, returns its index in its region
+    int add(Chunk *chunk, glm::ivec3 coords);
+    Chunk *remove(glm::ivec3 coords, int index);
+    void clear();
+    size_t size() const { return chunkCount; }
+    size_t getRegionCount() const { return regions.size(); }
+
+    // same contract as ChunkBoundsTable::cull
+    void cull(const Frustum &frustum, glm::vec3 rangeMin, glm::vec3 rangeMax,
+              std::vector<Chunk *> &visible) const;
+
+  private:
+    struct Region {
+        glm::vec3 min; // min corner of its first chunk's box
+        ChunkBoundsTable chunks;
+    };
+
+    float chunkSize;    // world units
+    float boundsOffset; // from the chunk grid to the boxes
+    size_t chunkCount = 0;
+    std::unordered_map<uint64_t, Region> regions;
+
+    void cullRegion(const Region &region, const Frustum &frustum,
+                    glm::vec3 rangeMin, glm::vec3 rangeMax,
+                    std::vector<Chunk *> &visible) const;
+
+    static inline glm::ivec3 getRegionCoords(glm::ivec3 coords) {
+        return {coords.x >> REGION_SHIFT, coords.y >> REGION_SHIFT,
+                coords.z >> REGION_SHIFT};
+    }
+};
+
+int ChunkRegionGrid::add(Chunk *chunk, glm::ivec3 coords) {
+    glm::ivec3 regionCoords = getRegionCoords(coords);
+    uint64_t key =
+        ChunkMap::packKey(regionCoords.x, regionCoords.y, regionCoords.z);
+    std::unordered_map<uint64_t, Region>::iterator region = regions.find(key);
+    if (region == regions.end()) {
+        region = regions.emplace(key, Region()).first;
+        region->second.min =
+            glm::vec3(regionCoords.x, regionCoords.y, regionCoords.z) *
+                (chunkSize * REGION_CHUNKS) +
+            glm::vec3(boundsOffset);
+    }
+    chunkCount++;
+    glm::vec3 min = glm::vec3(coords.x, coords.y, coords.z) * chunkSize +
+                    glm::vec3(boundsOffset);
+    return region->second.chunks.add(chunk, min, min + glm::vec3(chunkSize));
+}
+
+Chunk *ChunkRegionGrid::remove(glm::ivec3 coords, int index) {
+    glm::ivec3 regionCoords = getRegionCoords(coords);
+    std::unordered_map<uint64_t, Region>::iterator region = regions.find(
+        ChunkMap::packKey(regionCoords.x, regionCoords.y, regionCoords.z));
+    chunkCount--;
+    Chunk *moved = region->second.chunks.remove(index);
+    if (region->second.chunks.size() == 0) {
+        regions.erase(region);
+    }
+    return moved;
+}
+
+void ChunkRegionGrid::clear() {
+    regions.clear();
+    chunkCount = 0;
+}
+
+void ChunkRegionGrid::cull(const Frustum &frustum, glm::vec3 rangeMin,
+                           glm::vec3 rangeMax,
+                           std::vector<Chunk *> &visible) const {
+    if (regions.empty()) {
+        return;
+    }
+    glm::ivec3 first = getRegionCoords(
+        glm::ivec3((int)std::floor(rangeMin.x / chunkSize),
+                   (int)std::floor(rangeMin.y / chunkSize),
+                   (int)std::floor(rangeMin.z / chunkSize)));
+    glm::ivec3 last = getRegionCoords(
+        glm::ivec3((int)std::floor(rangeMax.x / chunkSize),
+                   (int)std::floor(rangeMax.y / chunkSize),
+                   (int)std::floor(rangeMax.z / chunkSize)));
+    size_t rangeRegions = (size_t)(last.x - first.x + 1) *
+                          (last.y - first.y + 1) * (last.z - first.z + 1);
+    // min corners of the first and last chunk boxes in range
+    rangeMin += glm::vec3(boundsOffset);
+    rangeMax += glm::vec3(boundsOffset);
+
+    // a range much bigger than the loaded world is cheaper to check against
+    // every region than to look up region by region
+    if (rangeRegions > regions.size()) {
+        glm::vec3 lastChunkOffset(chunkSize * (REGION_CHUNKS - 1));
+        for (const std::pair<const uint64_t, Region> &region : regions) {
+            glm::vec3 min = region.second.min;
+            glm::vec3 max = min + lastChunkOffset;
+            if (max.x < rangeMin.x || max.y < rangeMin.y || max.z < rangeMin.z ||
+                min.x > rangeMax.x || min.y > rangeMax.y || min.z > rangeMax.z) {
+                continue;
+            }
+            cullRegion(region.second, frustum, rangeMin, rangeMax, visible);
+        }
+        return;
+    }
+
+    for (int z = first.z; z <= last.z; z++) {
+        for (int y = first.y; y <= last.y; y++) {
+            for (int x = first.x; x <= last.x; x++) {
+                std::unordered_map<uint64_t, Region>::const_iterator region =
+                    regions.find(ChunkMap::packKey(x, y, z));
+                if (region != regions.end()) {
+                    cullRegion(region->second, frustum, rangeMin, rangeMax,
+                               visible);
+                }
+            }
+        }
+    }
+}
+
+void ChunkRegionGrid::cullRegion(const Region &region, const Frustum &frustum,
+                                 glm::vec3 rangeMin, glm::vec3 rangeMax,
+                                 std::vector<Chunk *> &visible) const {
+    float halfSize = chunkSize * REGION_CHUNKS / 2;
+    int result = frustum.CubeInFrustum(region.min + glm::vec3(halfSize),
+                                       halfSize, halfSize, halfSize);
+    if (result == Frustum::FRUSTUM_OUTSIDE) {
+        return;
+    }
+    // min corner of the region's last chunk
+    glm::vec3 max = region.min + glm::vec3(chunkSize * (REGION_CHUNKS - 1));
+    bool inRange = rangeMin.x <= region.min.x && rangeMin.y <= region.min.y &&
+                   rangeMin.z <= region.min.z && max.x <= rangeMax.x &&
+                   max.y <= rangeMax.y && max.z <= rangeMax.z;
+    if (result == Frustum::FRUSTUM_INSIDE && inRange) {
+        region.chunks.appendAll(visible);
+    } else {
+        region.chunks.cull(frustum, rangeMin, rangeMax, visible);
+    }
+}
+
+#endif // CHUNKBOUNDS_H
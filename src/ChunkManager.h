@@ -2,109 +2,201 @@
 #define CHUNKMANAGER_H
 
 #include "Chunk.h"
+#include "ChunkBounds.h"
+#include "ChunkMap.h"
+#include "ChunkRing.h"
+#include "EventQueue.h"
+#include "JobSystem.h"
+#include "OcclusionCuller.h"
 
 #include <learnopengl/shader_m.h>
+#include <algorithm>
+#include <chrono>
+#include <cmath>
 #include <unordered_map>
+#include <unordered_set>
 #include <vector>
-#include <future>
+#include <thread>
 
 /*
     TODO LIST:
-    - feat: async chunk loading?
-    - feat: chunk unloading?
     - fix: some chunks (def. first one) has weird alpha rendering bug - need to
    investigate the cause of this later.
 */
 
-class TPoint3D {
-  public:
-    TPoint3D(float x, float y, float z) : x(x), y(y), z(z){};
+typedef std::vector<Chunk *> ChunkList;
 
-    float x, y, z;
+// a mesh built by a job, waiting to be uploaded to the GPU
+struct ChunkMeshUpload {
+    Chunk *chunk;
+    ChunkMesh mesh;
 };
 
-struct hashFunc {
-    size_t operator()(const TPoint3D &k) const {
-        size_t h1 = std::hash<float>()(k.x);
-        size_t h2 = std::hash<float>()(k.y);
-        size_t h3 = std::hash<float>()(k.z);
-        return (h1 ^ (h2 << 1)) ^ h3;
-    }
-};
+// running estimate of the main thread time one item of a stage takes
+struct StageCost {
+    double itemMS = 0.05;
 
-struct equalsFunc {
-    bool operator()(const TPoint3D &lhs, const TPoint3D &rhs) const {
-        return (lhs.x == rhs.x) && (lhs.y == rhs.y) && (lhs.z == rhs.z);
+    void add(double elapsedMS, int items) {
+        if (items > 0) {
+            itemMS += (elapsedMS / items - itemMS) * 0.1;
+        }
     }
 };
 
-typedef std::vector<Chunk *> ChunkList;
-typedef std::unordered_map<TPoint3D, Chunk *, hashFunc, equalsFunc> ChunkMap;
-
 struct ChunkManager {
-    static int const ASYNC_NUM_CHUNKS_PER_FRAME = 12;
-    static constexpr int WORLD_SIZE = 16; // world size in chunks
-    static constexpr int WORLD_SIZE_CUBED =
-        WORLD_SIZE * WORLD_SIZE * WORLD_SIZE;
-
-    // Chunk *chunks[WORLD_SIZE_CUBED]; // array of chunks
-    Chunk *chunks[WORLD_SIZE_CUBED] = {nullptr};
+    static constexpr int UNLOAD_INTERVAL_FRAMES = 30; // frames between passes
+    static constexpr int GENERATE_JOBS_PER_WORKER = 8;
+    static constexpr int PREFETCH_MAX_CHUNKS = 16; // furthest look ahead
+    static constexpr float VELOCITY_SMOOTHING_SECONDS = 0.25f;
+    static constexpr float RATE_SMOOTHING_SECONDS = 1.0f;
+    static constexpr int WORLD_SIZE = 16; // pregenerated world size in chunks
+    // from the chunk grid to the chunkRegions boxes, half a block
+    static constexpr float BOUNDS_OFFSET = -Block::BLOCK_RENDER_SIZE / 2.0f;
+    static constexpr int MAX_OCCLUDERS = 64; // nearest solid chunks drawn
 
-    inline int getChunkIndex(int x, int y, int z) const {
-        return x + y * WORLD_SIZE + z * WORLD_SIZE * WORLD_SIZE;
-    }
-
-    inline int chunkIndexFromChunkPos(int x, int y, int z) const {
-        int halfWorldSize =
-            (WORLD_SIZE * (Chunk::CHUNK_SIZE * Block::BLOCK_RENDER_SIZE)) / 2;
-        int result = ((x + halfWorldSize) /
-                      (Chunk::CHUNK_SIZE * Block::BLOCK_RENDER_SIZE)) +
-                     ((y + halfWorldSize) /
-                      (Chunk::CHUNK_SIZE * Block::BLOCK_RENDER_SIZE)) *
-                         WORLD_SIZE +
-                     ((z + halfWorldSize) /
-                      (Chunk::CHUNK_SIZE * Block::BLOCK_RENDER_SIZE)) *
-                         WORLD_SIZE * WORLD_SIZE;
+    // every chunk by integer chunk coordinates, see getChunkCoords. Lookups
+    // are safe from any thread, inserts and removes take chunkMutex. Go
+    // through findChunk, insertChunk and removeChunk to keep both in step.
+    ChunkMap chunks;
+    // the chunks within chunkGenDistance of the camera's chunk, where almost
+    // every lookup lands, without hashing
+    ChunkRing nearChunks;
 
-        return result;
+    // chunk coordinates of the chunk whose minimum corner is at position
+    static inline glm::ivec3 getChunkCoords(glm::vec3 position) {
+        constexpr float size = Chunk::CHUNK_SIZE * Block::BLOCK_RENDER_SIZE;
+        return glm::ivec3((int)std::floor(position.x / size),
+                          (int)std::floor(position.y / size),
+                          (int)std::floor(position.z / size));
     }
 
     std::shared_ptr<std::mutex> chunkMutex;
     std::shared_ptr<std::mutex> visibilityMutex;
+    std::shared_ptr<JobSystem> jobSystem;
     ChunkManager();
     ChunkManager(unsigned int _chunkGenDistance,
                  unsigned int _chunkRenderDistance, Shader *_terrainShader);
     ~ChunkManager();
-    void update(float dt, Camera newCamera);
-    void updateAsyncChunker(Camera newCamera);
+    void update(float dt, const Camera &newCamera);
+    void updateAsyncChunker(const Camera &newCamera);
+    void updateCameraVelocity(float dt, glm::vec3 newCameraPosition);
+    void updateGenerateRate(float dt, bool generating);
+    void updatePrefetch();
+    bool isChunkWanted(glm::ivec3 coords) const;
+    void cancelUnwantedLoads();
+    void requestChunk(Chunk *chunk);
     void updateLoadList();
     void updateSetupList();
     void updateRebuildList();
+    void updateUploadList();
+    double getFrameElapsedMS() const;
+    bool hasFrameBudget(const StageCost &cost, int itemsDone) const;
+    void submitGenerateJob(Chunk *chunk);
+    float getChunkPriority(const Chunk *chunk) const;
+    template <typename T, typename ChunkOf>
+    void sortByPriority(std::vector<T> &items, ChunkOf chunkOf);
+    JobHandle submitMeshJob(Chunk *chunk,
+                            const std::vector<JobHandle> &dependencies = {});
     void updateFlagsList();
     void updateUnloadList(glm::vec3 newCameraPosition);
-    void updateVisibilityList(glm::vec3 newCameraPosition);
-    void updateRenderList(glm::vec3 newCameraPosition, Frustum frustum);
+    void retryDroppedMeshes(bool unloaded);
+    void unloadChunk(Chunk *chunk);
+    void deleteUnloadingChunks();
+    void updateChunkBounds(Chunk *chunk);
+    void updateRenderList(const Camera &newCamera);
+    void cullOccludedChunks(const Camera &newCamera);
 
     void pregenerateChunks();
 
     void QueueChunkToRebuild(Chunk *chunk);
+    void QueueNeighboursToRebuild(Chunk *chunk);
+    void QueueAllChunksToRebuild();
+    Chunk *getChunk(glm::vec3 chunkPosition);
+    Chunk *findChunk(int x, int y, int z) const;
+    void insertChunk(glm::ivec3 coords, Chunk *chunk);
+    void removeChunk(glm::ivec3 coords);
+    glm::vec3 GetNeighbourOffset(int face);
+    void updateChunkBorders(Chunk *chunk);
     std::pair<glm::vec3, glm::vec3>
     GetChunkGenRange(glm::vec3 newCameraPosition);
     std::pair<glm::vec3, glm::vec3>
     GetChunkRenderRange(glm::vec3 newCameraPosition);
-    void render(Camera newCamera);
+    void render();
 
     Shader *terrainShader;
 
-    ChunkList chunkLoadList;
-    ChunkList chunkSetupList;
+    // chunks only move between stages when something happens to them: jobs
+    // report back through these queues and the main thread drains them, so
+    // a frame only touches chunks whose state changed
+    EventQueue<Chunk *> requestedQueue;          // STATE_REQUESTED
+    EventQueue<Chunk *> generatedQueue;          // STATE_GENERATED
+    EventQueue<ChunkMeshUpload> meshUploadQueue; // STATE_MESHED
+
+    // pending work, sorted by getChunkPriority every frame
+    ChunkList chunkLoadList;  // requested, waiting for a free generate job
+    ChunkList chunkSetupList; // generated, waiting for a free mesh job
+    std::vector<ChunkMeshUpload> chunkUploadList;
     ChunkList chunkRebuildList;
     ChunkList chunkRenderList;
+    ChunkList occluderList;
     ChunkList chunkUnloadList;
-    ChunkList chunkVisibilityList;
+    ChunkList chunkVisibilityList; // every chunk that has been requested
+    // chunks with something to draw
+    ChunkRegionGrid chunkRegions{Chunk::CHUNK_SIZE * Block::BLOCK_RENDER_SIZE,
+                                 BOUNDS_OFFSET};
+
+    // meshes being built or waiting for upload, capped at maxMeshJobs
+    unsigned int meshJobsInFlight = 0;
+    unsigned int maxMeshJobs;
+    // kept low enough that new requests near the camera overtake old ones
+    unsigned int generateJobsInFlight = 0;
+    unsigned int maxGenerateJobs;
+
+    // main thread time the load, setup, rebuild and upload stages may take
+    // between them each frame, see hasFrameBudget
+    float frameBudgetMS = 4.0f;
+    std::chrono::steady_clock::time_point frameStart;
+    StageCost loadCost;
+    StageCost setupCost;
+    StageCost rebuildCost;
+    StageCost uploadCost;
 
     bool genChunk;
     bool forceVisibilityupdate;
+    bool drawWireframe = false; // debug overlay on top of the filled chunks
+    // camera chunk and distance updateAsyncChunker last requested chunks for
+    glm::ivec3 lastGenCameraChunk;
+    unsigned int lastGenDistance = 0;
+
+    // predictive prefetch, see updatePrefetch
+    glm::vec3 cameraVelocity = glm::vec3(0.0f); // smoothed, units per second
+    float generateRate;              // chunks generated per second, smoothed
+    unsigned int generatedThisFrame = 0;
+    // path the chunks were prefetched along, in chunk units
+    glm::vec3 prefetchStart = glm::vec3(0.0f);
+    glm::vec3 prefetchEnd = glm::vec3(0.0f);
+    glm::ivec3 prefetchStartChunk;
+    glm::ivec3 prefetchEndChunk;
+    bool prefetching = false;
+    // the gen range or prefetch path moved since the last cancel pass
+    bool loadRangeChanged = false;
+
+    // chunks outside chunkGenDistance are kept as a cache until these are
+    // exceeded, then the least recently visible ones are unloaded first.
+    // vramBudgetMB also caps the mesh arena, which never grows past it.
+    // RAM is the chunks' own payload: the slab pools keep freed blocks for
+    // reuse, that memory is on top and unloading doesn't give it back.
+    int ramBudgetMB = 512;
+    int vramBudgetMB = 256;
+    size_t chunkRamUsage = 0;  // as of the last unload pass
+    size_t chunkVramUsage = 0; // as of the last unload pass
+    bool meshArenaFull = false; // an upload didn't fit since the last pass
+    int droppedMeshCount = 0; // chunks not drawn for want of arena room
+    uint64_t frameCount = 0;
+    int renderedTriangleCount = 0; // triangles drawn last frame
+    bool occlusionCulling = true;
+    int occludedChunkCount = 0; // left out of the last render list
+    OcclusionCuller occlusionCuller;
     Camera camera;
 
     unsigned int chunkGenDistance;
@@ -113,6 +205,11 @@ struct ChunkManager {
 ChunkManager::ChunkManager() {
     chunkMutex = std::make_shared<std::mutex>();
     visibilityMutex = std::make_shared<std::mutex>();
+    jobSystem = std::make_shared<JobSystem>();
+    maxMeshJobs = jobSystem->getWorkerCount();
+    maxGenerateJobs = jobSystem->getWorkerCount() * GENERATE_JOBS_PER_WORKER;
+    // a guess until there is something to measure
+    generateRate = jobSystem->getWorkerCount() * 50.0f;
 }
 
 ChunkManager::ChunkManager(unsigned int _chunkGenDistance,
@@ -126,28 +223,38 @@ ChunkManager::ChunkManager(unsigned int _chunkGenDistance,
 
     chunkMutex = std::make_shared<std::mutex>();
     visibilityMutex = std::make_shared<std::mutex>();
+    jobSystem = std::make_shared<JobSystem>();
+    maxMeshJobs = jobSystem->getWorkerCount();
+    maxGenerateJobs = jobSystem->getWorkerCount() * GENERATE_JOBS_PER_WORKER;
+    // a guess until there is something to measure
+    generateRate = jobSystem->getWorkerCount() * 50.0f;
 }
 
-ChunkManager::~ChunkManager() {}
+ChunkManager::~ChunkManager() {
+    // let any jobs still running finish before the chunks go away
+    jobSystem->waitIdle();
+}
 
-// TODO: surely we can just pass the camera right?
-void ChunkManager::update(float dt, Camera newCamera) {
-    // if (genChunk) {
-    //     updateAsyncChunker(newCameraPosition);
-    //     // asyncChunkFuture = std::async(&ChunkManager::updateAsyncChunker,
-    //     // this,
-    //     //    newCameraPosition);
-    // }
+void ChunkManager::update(float dt, const Camera &newCamera) {
+    frameCount++;
+    frameStart = std::chrono::steady_clock::now();
+    updateCameraVelocity(dt, newCamera.cameraPos);
+    camera = newCamera; // what the stages prioritise for
+    if (genChunk) {
+        updateAsyncChunker(newCamera);
+        updatePrefetch();
+    }
     updateLoadList();
     // std::async(std::launch::async, &ChunkManager::updateLoadList, this);
+    bool generating = generateJobsInFlight > 0;
     updateSetupList();
+    updateGenerateRate(dt, generating);
     // std::async(std::launch::async, &ChunkManager::updateSetupList, this);
     updateRebuildList();
+    updateUploadList();
     // updateFlagsList();
-    // updateUnloadList(newCameraPosition);
-    updateVisibilityList(newCamera.cameraPos);
-    updateRenderList(newCamera.cameraPos, newCamera.frustum);
-    camera = newCamera;
+    updateUnloadList(newCamera.cameraPos);
+    updateRenderList(newCamera);
     // cameraPosition = camera.cameraPos;
     // cameraLookAt = newCameraLookAt;
 }
@@ -221,12 +328,14 @@ ChunkManager::GetChunkRenderRange(glm::vec3 newCameraPosition) {
                                            {endX, endY, endZ});
 }
 
+// generate and mesh the whole world up front, spread over every core. Each
+// chunk's mesh job waits for its own and its neighbours' generate jobs so
+// the borders it culls against are final.
 void ChunkManager::pregenerateChunks() {
     int halfWorldSize =
         (WORLD_SIZE * (Chunk::CHUNK_SIZE * Block::BLOCK_RENDER_SIZE)) / 2;
 
-    std::vector<std::future<void>> futures; // Store futures to manage threads
-
+    std::vector<Chunk *> newChunks;
     for (float i = -halfWorldSize; i < halfWorldSize;
          i += Chunk::CHUNK_SIZE * Block::BLOCK_RENDER_SIZE) {
         for (float j = -halfWorldSize; j < halfWorldSize;
@@ -238,48 +347,76 @@ void ChunkManager::pregenerateChunks() {
                     continue;
                 }
 
-                // Launch a new thread for each chunk generation
-                futures.emplace_back(std::async(std::launch::async, [this, i, j,
-                                                                     k]() {
-                    std::lock_guard<std::mutex> lock(
-                        *chunkMutex); // Ensure thread safety
+                glm::ivec3 coords = getChunkCoords({i, j, k});
+                if (findChunk(coords.x, coords.y, coords.z) != nullptr) {
+                    continue;
+                }
 
-                    size_t idx = chunkIndexFromChunkPos((int)i, (int)j, (int)k);
-                    Chunk *currChunk = chunks[idx];
-                    if (currChunk != nullptr) {
-                        return;
-                    }
+                // Create new chunk, it skips the event queues and goes
+                // straight from STATE_GENERATING to STATE_MESHING
+                Chunk *newChunk = new Chunk({i, j, k}, terrainShader);
+                newChunk->load();
+                newChunk->state = Chunk::STATE_GENERATING;
+                {
+                    std::lock_guard<std::mutex> lock(*chunkMutex);
+                    insertChunk(coords, newChunk);
+                }
+                newChunks.push_back(newChunk);
+                chunkVisibilityList.push_back(newChunk);
+            }
+        }
+    }
 
-                    // Create new chunk
-                    Chunk *newChunk = new Chunk({i, j, k}, terrainShader);
-                    chunks[idx] = newChunk;
+    std::unordered_map<Chunk *, JobHandle> generateJobs;
+    std::vector<JobHandle> meshJobs;
+    for (Chunk *chunk : newChunks) {
+        generateJobs[chunk] =
+            jobSystem->submit([chunk]() { chunk->generate(); });
+    }
 
-                    std::lock_guard<std::mutex> visibilityLock(
-                        *visibilityMutex);
-                    chunkVisibilityList.push_back(newChunk);
-                }));
+    for (Chunk *chunk : newChunks) {
+        std::vector<JobHandle> dependencies = {generateJobs[chunk]};
+        for (int face = 0; face < Chunk::FACE_COUNT; face++) {
+            Chunk *neighbour =
+                getChunk(chunk->chunkPosition + GetNeighbourOffset(face));
+            auto found = generateJobs.find(neighbour);
+            if (found != generateJobs.end()) {
+                dependencies.push_back(found->second);
             }
         }
+        meshJobs.push_back(submitMeshJob(chunk, dependencies));
     }
 
-    // Wait for all threads to finish
-    for (auto &fut : futures) {
-        fut.get();
-    }
+    // Wait for all jobs to finish, the meshes are uploaded over the next
+    // frames by updateUploadList
+    jobSystem->wait(meshJobs);
 }
 
-void ChunkManager::updateAsyncChunker(Camera newCamera) {
-    if (newCamera.cameraPos == camera.cameraPos) {
+// request every chunk within chunkGenDistance, only once the camera has
+// moved into another chunk
+void ChunkManager::updateAsyncChunker(const Camera &newCamera) {
+    glm::ivec3 cameraChunk = getChunkCoords(newCamera.cameraPos);
+    if (cameraChunk == lastGenCameraChunk &&
+        chunkGenDistance == lastGenDistance) {
         return;
     }
+    // no job is looking chunks up yet
+    if (chunkGenDistance != lastGenDistance) {
+        nearChunks.resize((int)chunkGenDistance, cameraChunk.x, cameraChunk.y,
+                          cameraChunk.z, chunks);
+    } else {
+        nearChunks.recentre(cameraChunk.x, cameraChunk.y, cameraChunk.z,
+                            chunks);
+    }
+    lastGenCameraChunk = cameraChunk;
+    lastGenDistance = chunkGenDistance;
+    loadRangeChanged = true;
 
     std::pair<glm::vec3, glm::vec3> chunkRange =
-        GetChunkGenRange(camera.cameraPos);
+        GetChunkGenRange(newCamera.cameraPos);
     glm::vec3 start = chunkRange.first;
     glm::vec3 end = chunkRange.second;
 
-    std::vector<std::future<void>> futures; // Store futures to manage threads
-
     for (float i = start.x; i < end.x;
          i += Chunk::CHUNK_SIZE * Block::BLOCK_RENDER_SIZE) {
         for (float j = start.y; j < end.y;
@@ -291,218 +428,820 @@ void ChunkManager::updateAsyncChunker(Camera newCamera) {
                     continue;
                 }
 
-                // Launch a new thread for each chunk generation
-                futures.emplace_back(std::async(std::launch::async, [this, i, j,
-                                                                     k]() {
-                    std::lock_guard<std::mutex> lock(
-                        *chunkMutex); // Ensure thread safety
-
-                    size_t idx = chunkIndexFromChunkPos((int)i, (int)j, (int)k);
-                    Chunk *currChunk = chunks[idx];
-                    if (currChunk != nullptr) {
-                        if (!currChunk->isLoaded()) {
-                            std::lock_guard<std::mutex> visibilityLock(
-                                *visibilityMutex);
-                            chunkVisibilityList.push_back(currChunk);
-                        }
-                        return;
+                // only this thread inserts, so a lookup is enough
+                glm::ivec3 coords = getChunkCoords({i, j, k});
+                Chunk *currChunk = findChunk(coords.x, coords.y, coords.z);
+                if (currChunk != nullptr) {
+                    if (!currChunk->isLoaded()) {
+                        requestChunk(currChunk);
                     }
+                    continue;
+                }
 
-                    // Create new chunk
-                    Chunk *newChunk = new Chunk({i, j, k}, terrainShader);
-                    chunks[idx] = newChunk;
+                // Create new chunk
+                Chunk *newChunk = new Chunk({i, j, k}, terrainShader);
+                {
+                    std::lock_guard<std::mutex> lock(*chunkMutex);
+                    insertChunk(coords, newChunk);
+                }
+                {
+                    std::lock_guard<std::mutex> visibilityLock(
+                        *visibilityMutex);
+                    chunkVisibilityList.push_back(newChunk);
+                }
+                requestChunk(newChunk);
+            }
+        }
+    }
+}
 
+// smoothed camera velocity from how far it moved since last frame
+void ChunkManager::updateCameraVelocity(float dt, glm::vec3 newCameraPosition) {
+    if (frameCount == 1 || dt <= 0.0f) {
+        return; // no previous position yet
+    }
+    glm::vec3 velocity = (newCameraPosition - camera.cameraPos) / dt;
+    float blend = 1.0f - std::exp(-dt / VELOCITY_SMOOTHING_SECONDS);
+    cameraVelocity += (velocity - cameraVelocity) * blend;
+}
+
+// smoothed generate job throughput, only frames that had generate jobs in
+// flight say anything about it
+void ChunkManager::updateGenerateRate(float dt, bool generating) {
+    unsigned int generated = generatedThisFrame;
+    generatedThisFrame = 0;
+    if (!generating || dt <= 0.0f) {
+        return;
+    }
+    float blend = 1.0f - std::exp(-dt / RATE_SMOOTHING_SECONDS);
+    generateRate += (generated / dt - generateRate) * blend;
+}
+
+// request the chunks along the path the camera is heading, far enough ahead
+// that they are generated by the time it gets there: the look ahead is the
+// time to get through the chunks already queued plus the slab of the gen
+// range a step into a new chunk adds, at the measured generate rate. Only
+// redone when the camera's chunk or the end of the path changes.
+void ChunkManager::updatePrefetch() {
+    constexpr float chunkSize = Chunk::CHUNK_SIZE * Block::BLOCK_RENDER_SIZE;
+    float radius = (float)chunkGenDistance;
+    float speed = glm::length(cameraVelocity);
+    float slab = (2.0f * radius) * (2.0f * radius);
+    float queued = (float)(chunkLoadList.size() + generateJobsInFlight);
+    float seconds = (queued + slab) / std::max(generateRate, 1.0f);
+    float lookAhead =
+        std::min(speed * seconds / chunkSize, (float)PREFETCH_MAX_CHUNKS);
+
+    glm::vec3 start = camera.cameraPos / chunkSize;
+    glm::vec3 end = start;
+    bool active = lookAhead >= 1.0f;
+    if (active) {
+        end += cameraVelocity * (lookAhead / speed);
+    }
+    glm::ivec3 startChunk = getChunkCoords(camera.cameraPos);
+    glm::ivec3 endChunk = getChunkCoords(end * chunkSize);
+    if (active == prefetching && startChunk == prefetchStartChunk &&
+        endChunk == prefetchEndChunk) {
+        return;
+    }
+    prefetchStart = start;
+    prefetchEnd = end;
+    prefetchStartChunk = startChunk;
+    prefetchEndChunk = endChunk;
+    prefetching = active;
+    loadRangeChanged = true;
+    if (!prefetching) {
+        return;
+    }
+
+    int reach = (int)chunkGenDistance;
+    int minX = std::min(startChunk.x, endChunk.x) - reach;
+    int maxX = std::max(startChunk.x, endChunk.x) + reach;
+    int minY = std::min(startChunk.y, endChunk.y) - reach;
+    int maxY = std::min(std::max(startChunk.y, endChunk.y) + reach, -1);
+    int minZ = std::min(startChunk.z, endChunk.z) - reach;
+    int maxZ = std::max(startChunk.z, endChunk.z) + reach;
+    for (int x = minX; x <= maxX; x++) {
+        for (int y = minY; y <= maxY; y++) {
+            for (int z = minZ; z <= maxZ; z++) {
+                glm::ivec3 coords(x, y, z);
+                if (!isChunkWanted(coords) ||
+                    findChunk(x, y, z) != nullptr) {
+                    continue;
+                }
+                Chunk *newChunk = new Chunk(
+                    glm::vec3(x * chunkSize, y * chunkSize, z * chunkSize),
+                    terrainShader);
+                {
+                    std::lock_guard<std::mutex> lock(*chunkMutex);
+                    insertChunk(coords, newChunk);
+                }
+                {
                     std::lock_guard<std::mutex> visibilityLock(
                         *visibilityMutex);
                     chunkVisibilityList.push_back(newChunk);
-                }));
+                }
+                requestChunk(newChunk);
             }
         }
     }
+}
 
-    // Wait for all threads to finish
-    for (auto &fut : futures) {
-        fut.get();
+// in the gen range around the camera's chunk, or within chunkGenDistance of
+// the prefetch path
+bool ChunkManager::isChunkWanted(glm::ivec3 coords) const {
+    int reach = (int)chunkGenDistance;
+    if (std::abs(coords.x - lastGenCameraChunk.x) <= reach &&
+        std::abs(coords.y - lastGenCameraChunk.y) <= reach &&
+        std::abs(coords.z - lastGenCameraChunk.z) <= reach) {
+        return true;
+    }
+    if (!prefetching) {
+        return false;
     }
+    // distance from the chunk's centre to the closest point on the path
+    glm::vec3 centre(coords.x + 0.5f, coords.y + 0.5f, coords.z + 0.5f);
+    glm::vec3 path = prefetchEnd - prefetchStart;
+    float t = glm::dot(centre - prefetchStart, path) / glm::dot(path, path);
+    t = std::min(std::max(t, 0.0f), 1.0f);
+    return glm::length(centre - (prefetchStart + path * t)) <= reach;
 }
 
+// forget chunks the camera no longer needs, e.g. prefetched ones once it has
+// turned around: requested ones that no job has started on, and generated
+// ones still waiting in chunkSetupList. Ones being generated or meshed are
+// left to the unload pass.
+void ChunkManager::cancelUnwantedLoads() {
+    loadRangeChanged = false;
+    bool cancelled = false;
+    for (Chunk *pChunk : chunkLoadList) {
+        glm::ivec3 coords = getChunkCoords(pChunk->chunkPosition);
+        if (isChunkWanted(coords)) {
+            continue;
+        }
+        // requestedQueue has just been drained, nothing else refers to it
+        // but the rebuild list
+        if (pChunk->rebuildQueued) {
+            chunkRebuildList.erase(std::remove(chunkRebuildList.begin(),
+                                               chunkRebuildList.end(), pChunk),
+                                   chunkRebuildList.end());
+            pChunk->rebuildQueued = false;
+        }
+        pChunk->state = Chunk::STATE_UNLOADING;
+        pChunk->loadQueued = false;
+        {
+            std::lock_guard<std::mutex> lock(*chunkMutex);
+            removeChunk(coords);
+        }
+        cancelled = true;
+    }
+    for (Chunk *pChunk : chunkSetupList) {
+        if (pChunk->state == Chunk::STATE_GENERATED &&
+            !isChunkWanted(getChunkCoords(pChunk->chunkPosition))) {
+            unloadChunk(pChunk);
+            cancelled = true;
+        }
+    }
+    if (!cancelled) {
+        return;
+    }
+    chunkLoadList.erase(std::remove_if(chunkLoadList.begin(),
+                                       chunkLoadList.end(),
+                                       [](Chunk *chunk) {
+                                           return chunk->state ==
+                                                  Chunk::STATE_UNLOADING;
+                                       }),
+                        chunkLoadList.end());
+    deleteUnloadingChunks();
+}
+
+// have chunk loaded and generated, safe to call from any thread
+void ChunkManager::requestChunk(Chunk *chunk) { requestedQueue.push(chunk); }
+
+// start generating the requested chunks the camera needs most
 void ChunkManager::updateLoadList() {
-    int lNumOfChunksLoaded = 0;
+    Chunk *pChunk;
+    while (requestedQueue.pop(pChunk)) {
+        if (pChunk->state == Chunk::STATE_REQUESTED && !pChunk->loadQueued) {
+            pChunk->loadQueued = true;
+            chunkLoadList.push_back(pChunk);
+        }
+    }
+    if (loadRangeChanged) {
+        cancelUnwantedLoads();
+    }
+    if (chunkLoadList.empty() || generateJobsInFlight >= maxGenerateJobs) {
+        return;
+    }
+
+    sortByPriority(chunkLoadList, [](Chunk *chunk) { return chunk; });
+    double stageStart = getFrameElapsedMS();
+    int processed = 0;
     ChunkList::iterator iterator;
     for (iterator = chunkLoadList.begin();
          iterator != chunkLoadList.end() &&
-         (lNumOfChunksLoaded != ASYNC_NUM_CHUNKS_PER_FRAME);
+         generateJobsInFlight < maxGenerateJobs &&
+         hasFrameBudget(loadCost, processed);
          ++iterator) {
-        Chunk *pChunk = (*iterator);
-        if (pChunk->isLoaded() == false) {
-            if (lNumOfChunksLoaded != ASYNC_NUM_CHUNKS_PER_FRAME) {
-                pChunk->load();
-                lNumOfChunksLoaded++;
-                forceVisibilityupdate = true;
-            }
-        }
-    } // Clear the load list (every frame)
-    chunkLoadList.clear();
+        pChunk = (*iterator);
+        pChunk->loadQueued = false;
+        pChunk->load();
+        submitGenerateJob(pChunk);
+        forceVisibilityupdate = true;
+        processed++;
+    }
+    chunkLoadList.erase(chunkLoadList.begin(), iterator);
+    loadCost.add(getFrameElapsedMS() - stageStart, processed);
+}
+
+// lower goes first: distance from the camera to the chunk's centre, counted
+// up to three times over for chunks behind the camera
+float ChunkManager::getChunkPriority(const Chunk *chunk) const {
+    constexpr float halfSize = (Chunk::CHUNK_SIZE * Block::BLOCK_RENDER_SIZE) / 2;
+    glm::vec3 toChunk = chunk->chunkPosition +
+                        glm::vec3(halfSize, halfSize, halfSize) -
+                        camera.cameraPos;
+    float distance = glm::length(toChunk);
+    if (distance < halfSize) {
+        return 0.0f; // the camera is inside it
+    }
+    float facing = glm::dot(toChunk / distance, camera.cameraFront);
+    return distance * (2.0f - facing);
+}
+
+// order items by the priority of their chunk (chunkOf(item)), computing each
+// key once
+template <typename T, typename ChunkOf>
+void ChunkManager::sortByPriority(std::vector<T> &items, ChunkOf chunkOf) {
+    std::vector<std::pair<float, T>> keyed;
+    keyed.reserve(items.size());
+    for (const T &item : items) {
+        keyed.push_back({getChunkPriority(chunkOf(item)), item});
+    }
+    std::stable_sort(keyed.begin(), keyed.end(),
+                     [](const std::pair<float, T> &a,
+                        const std::pair<float, T> &b) {
+                         return a.first < b.first;
+                     });
+    for (size_t i = 0; i < keyed.size(); i++) {
+        items[i] = keyed[i].second;
+    }
+}
+
+// generate the blocks of chunk on a worker thread, updateSetupList picks it
+// up
+void ChunkManager::submitGenerateJob(Chunk *chunk) {
+    chunk->state = Chunk::STATE_GENERATING;
+    generateJobsInFlight++;
+    jobSystem->submit([this, chunk]() {
+        chunk->generate();
+        chunk->state = Chunk::STATE_GENERATED;
+        generatedQueue.push(chunk);
+    });
 }
 
-void ChunkManager::updateSetupList() { // Setup any chunks that have not
-                                       // already been setup
+void ChunkManager::updateSetupList() {
+    // Take every newly generated chunk first so that chunks generated in the
+    // same frame can cull the faces they share
+    Chunk *pChunk;
+    while (generatedQueue.pop(pChunk)) {
+        generateJobsInFlight--;
+        generatedThisFrame++;
+        QueueNeighboursToRebuild(pChunk);
+        chunkSetupList.push_back(pChunk);
+    }
+    if (chunkSetupList.empty()) {
+        return;
+    }
+
+    sortByPriority(chunkSetupList, [](Chunk *chunk) { return chunk; });
+    double stageStart = getFrameElapsedMS();
+    int processed = 0;
     ChunkList::iterator iterator;
-    for (iterator = chunkSetupList.begin(); iterator != chunkSetupList.end();
-         ++iterator) {
-        Chunk *pChunk = (*iterator);
-        if (pChunk->isLoaded() && pChunk->isSetup() == false) {
-            pChunk->setup();
-            if (pChunk->isSetup()) { // Only force the visibility update if we
-                                     // actually setup the chunk, some chunks
-                                     // wait in the pre-setup stage...
-                forceVisibilityupdate = true;
-            }
+    for (iterator = chunkSetupList.begin();
+         iterator != chunkSetupList.end() && meshJobsInFlight < maxMeshJobs &&
+         hasFrameBudget(setupCost, processed);
+         ++iterator, processed++) {
+        pChunk = (*iterator);
+        updateChunkBorders(pChunk);
+        if (pChunk->needsMesh()) {
+            submitMeshJob(pChunk);
+        } else {
+            pChunk->clearMesh();
+            pChunk->state = Chunk::STATE_UPLOADED;
+            updateChunkBounds(pChunk);
+            forceVisibilityupdate = true;
         }
-    } // Clear the setup list (every frame)
-    chunkSetupList.clear();
+    }
+    // the rest get another go next frame
+    chunkSetupList.erase(chunkSetupList.begin(), iterator);
+    setupCost.add(getFrameElapsedMS() - stageStart, processed);
 }
 
 void ChunkManager::QueueChunkToRebuild(Chunk *chunk) {
+    if (chunk->rebuildQueued) {
+        return;
+    }
+    chunk->rebuildQueued = true;
     chunkRebuildList.push_back(chunk);
 }
 
+// the blocks of chunk changed, so any neighbour that was already meshed
+// against the old blocks needs its border faces redone
+void ChunkManager::QueueNeighboursToRebuild(Chunk *chunk) {
+    for (int face = 0; face < Chunk::FACE_COUNT; face++) {
+        Chunk *neighbour =
+            getChunk(chunk->chunkPosition + GetNeighbourOffset(face));
+        // a mesh still being built may have been built against the old blocks
+        if (neighbour != nullptr &&
+            (neighbour->isSetup() || neighbour->isMeshPending())) {
+            QueueChunkToRebuild(neighbour);
+        }
+    }
+}
+
+// returns nullptr if there is no chunk at that position (yet), safe to call
+// from any thread
+Chunk *ChunkManager::getChunk(glm::vec3 chunkPosition) {
+    glm::ivec3 coords = getChunkCoords(chunkPosition);
+    return findChunk(coords.x, coords.y, coords.z);
+}
+
+// returns nullptr if there is no chunk at those chunk coordinates
+Chunk *ChunkManager::findChunk(int x, int y, int z) const {
+    if (nearChunks.contains(x, y, z)) {
+        return nearChunks.find(x, y, z);
+    }
+    return chunks.find(x, y, z);
+}
+
+// callers hold chunkMutex
+void ChunkManager::insertChunk(glm::ivec3 coords, Chunk *chunk) {
+    chunks.insert(coords.x, coords.y, coords.z, chunk);
+    if (nearChunks.contains(coords.x, coords.y, coords.z)) {
+        nearChunks.set(coords.x, coords.y, coords.z, chunk);
+    }
+}
+
+// callers hold chunkMutex
+void ChunkManager::removeChunk(glm::ivec3 coords) {
+    chunks.remove(coords.x, coords.y, coords.z);
+    if (nearChunks.contains(coords.x, coords.y, coords.z)) {
+        nearChunks.set(coords.x, coords.y, coords.z, nullptr);
+    }
+}
+
+// offset from a chunk's position to the neighbour across the given face
+glm::vec3 ChunkManager::GetNeighbourOffset(int face) {
+    glm::vec3 offset(0.0f);
+    offset[face / 2] = (face % 2 == 0 ? -1.0f : 1.0f) * Chunk::CHUNK_SIZE *
+                       Block::BLOCK_RENDER_SIZE;
+    return offset;
+}
+
+// copy the layer of blocks touching each face of chunk out of its
+// neighbours, missing or ungenerated neighbours count as empty
+void ChunkManager::updateChunkBorders(Chunk *chunk) {
+    for (int face = 0; face < Chunk::FACE_COUNT; face++) {
+        int axis = face / 2;
+        int u = (axis + 1) % 3;
+        int v = (axis + 2) % 3;
+        chunk->borders[face].reset();
+
+        Chunk *neighbour =
+            getChunk(chunk->chunkPosition + GetNeighbourOffset(face));
+        if (neighbour == nullptr || !neighbour->isGenerated()) {
+            continue;
+        }
+        if (neighbour->isUniform()) {
+            if (neighbour->getUniformBlock().isActive) {
+                chunk->borders[face].set();
+            }
+            continue;
+        }
+
+        int pos[3];
+        pos[axis] = (face % 2 == 0) ? Chunk::CHUNK_SIZE - 1 : 0;
+        for (int j = 0; j < Chunk::CHUNK_SIZE; j++) {
+            for (int i = 0; i < Chunk::CHUNK_SIZE; i++) {
+                pos[u] = i;
+                pos[v] = j;
+                chunk->borders[face][Chunk::getBorderIndex(axis, pos)] =
+                    neighbour
+                        ->getBlock(neighbour->getIndex(pos[0], pos[1], pos[2]))
+                        .isActive;
+            }
+        }
+    }
+}
+
+// e.g. after switching Chunk::meshingMode. Chunks that aren't set up yet
+// get the new mode when they are.
+void ChunkManager::QueueAllChunksToRebuild() {
+    for (Chunk *chunk : chunkVisibilityList) {
+        if (chunk->isSetup()) {
+            QueueChunkToRebuild(chunk);
+        }
+    }
+}
+
 void ChunkManager::updateRebuildList() {
     // Rebuild any chunks that are in the rebuild chunk list
+    if (chunkRebuildList.empty()) {
+        return;
+    }
+    sortByPriority(chunkRebuildList, [](Chunk *chunk) { return chunk; });
+    double stageStart = getFrameElapsedMS();
+    int processed = 0;
     ChunkList::iterator iterator;
-    int lNumRebuiltChunkThisFrame = 0;
+    ChunkList deferred;
     for (iterator = chunkRebuildList.begin();
          iterator != chunkRebuildList.end() &&
-         (lNumRebuiltChunkThisFrame != ASYNC_NUM_CHUNKS_PER_FRAME);
+         meshJobsInFlight < maxMeshJobs &&
+         hasFrameBudget(rebuildCost, processed);
          ++iterator) {
         Chunk *pChunk = (*iterator);
+        if (pChunk->isMeshPending()) {
+            // the mesh in flight may be stale, rebuild once it has landed
+            deferred.push_back(pChunk);
+            continue;
+        }
+        pChunk->rebuildQueued = false;
+        processed++;
         if (pChunk->isLoaded() && pChunk->isSetup()) {
-            if (lNumRebuiltChunkThisFrame != ASYNC_NUM_CHUNKS_PER_FRAME) {
-                pChunk->rebuildMesh(); // If we rebuild a chunk, add it to the
-                                       // list of chunks that need their render
-                                       // flags updated
-                // since we might now be empty or surrounded
-                // m_vpChunkupdateFlagsList.push_back(pChunk); // Also add our
-                // neighbours since they might now be surrounded too (If we have
-                // neighbours) Chunk * pChunkXMinus = GetChunk(pChunk -> GetX()
-                // - 1, pChunk -> GetY(), pChunk -> GetZ()); Chunk * pChunkXPlus
-                // = GetChunk(pChunk -> GetX() + 1, pChunk -> GetY(), pChunk ->
-                // GetZ()); Chunk * pChunkYMinus = GetChunk(pChunk -> GetX(),
-                // pChunk -> GetY() - 1, pChunk -> GetZ()); Chunk * pChunkYPlus
-                // = GetChunk(pChunk -> GetX(), pChunk -> GetY() + 1, pChunk ->
-                // GetZ()); Chunk * pChunkZMinus = GetChunk(pChunk -> GetX(),
-                // pChunk -> GetY(), pChunk -> GetZ() - 1); Chunk * pChunkZPlus
-                // = GetChunk(pChunk -> GetX(), pChunk -> GetY(), pChunk ->
-                // GetZ() + 1); if (pChunkXMinus != NULL)
-                // m_vpChunkupdateFlagsList.push_back(pChunkXMinus); if
-                // (pChunkXPlus != NULL)
-                // m_vpChunkupdateFlagsList.push_back(pChunkXPlus); if
-                // (pChunkYMinus != NULL)
-                // m_vpChunkupdateFlagsList.push_back(pChunkYMinus); if
-                // (pChunkYPlus != NULL)
-                // m_vpChunkupdateFlagsList.push_back(pChunkYPlus); if
-                // (pChunkZMinus != NULL)
-                // m_vpChunkupdateFlagsList.push_back(pChunkZMinus); if
-                // (pChunkZPlus != NULL)
-                // m_vpChunkupdateFlagsList.push_back(pChunkZPlus); // Only
-                // rebuild a certain number of chunks per frame
-                lNumRebuiltChunkThisFrame++;
-                forceVisibilityupdate = true;
+            updateChunkBorders(pChunk);
+            if (pChunk->needsMesh()) {
+                submitMeshJob(pChunk);
+            } else {
+                pChunk->clearMesh();
+                pChunk->state = Chunk::STATE_UPLOADED;
+                updateChunkBounds(pChunk);
             }
         }
     }
-    // Clear the rebuild list
-    chunkRebuildList.clear();
-}
-
-// unload chunks
-// void ChunkManager::updateUnloadList(glm::vec3 newCameraPosition) {
-//     ChunkList::iterator iterator;
-//     for (iterator = chunkUnloadList.begin(); iterator !=
-//     chunkUnloadList.end();
-//          iterator++) {
-//         Chunk *pChunk = (*iterator);
-//         if (pChunk->isLoaded()) {
-//             // TODO: async here?
-//             std::pair<glm::vec3, glm::vec3> chunkRange =
-//                 GetChunkGenRange(newCameraPosition);
-//             glm::vec3 start = chunkRange.first;
-//             glm::vec3 end = chunkRange.second;
-//             if (!((start.x <= pChunk->chunkPosition.x &&
-//                    pChunk->chunkPosition.x <= end.x) &&
-//                   (start.y <= pChunk->chunkPosition.y &&
-//                    pChunk->chunkPosition.y <= end.y) &&
-//                   (start.z <= pChunk->chunkPosition.z &&
-//                    pChunk->chunkPosition.z <= end.z))) {
-//                 pChunk->unload();
-//                 chunks.erase(TPoint3D(pChunk->chunkPosition.x,
-//                                       pChunk->chunkPosition.y,
-//                                       pChunk->chunkPosition.z));
-//                 // delete pChunk;
-//             }
-//         }
-//     }
-//     chunkUnloadList.clear();
-// }
-
-void ChunkManager::updateRenderList(glm::vec3 newCameraPosition,
-                                    Frustum frustum) {
-    // Clear the render list each frame BEFORE we do our tests to see what
-    // chunks should be rendered
-    chunkRenderList.clear();
-    ChunkList::iterator iterator;
-    for (iterator = chunkVisibilityList.begin();
-         iterator != chunkVisibilityList.end(); ++iterator) {
-        Chunk *pChunk = (*iterator);
-        if (pChunk != NULL) {
-            if (pChunk->isLoaded() && pChunk->isSetup()) {
-
-                std::pair<glm::vec3, glm::vec3> chunkRange =
-                    GetChunkRenderRange(newCameraPosition);
-                glm::vec3 start = chunkRange.first;
-                glm::vec3 end = chunkRange.second;
-                if (((start.x <= pChunk->chunkPosition.x &&
-                      pChunk->chunkPosition.x <= end.x) &&
-                     (start.y <= pChunk->chunkPosition.y &&
-                      pChunk->chunkPosition.y <= end.y) &&
-                     (start.z <= pChunk->chunkPosition.z &&
-                      pChunk->chunkPosition.z <= end.z))) {
-
-                    constexpr glm::vec3 offset = glm::vec3(
-                        (Chunk::CHUNK_SIZE * Block::BLOCK_RENDER_SIZE) / 2,
-                        (Chunk::CHUNK_SIZE * Block::BLOCK_RENDER_SIZE) / 2,
-                        (Chunk::CHUNK_SIZE * Block::BLOCK_RENDER_SIZE) / 2);
-                    glm::vec3 chunkCenter = pChunk->chunkPosition + offset;
-
-                    if (!frustum.CubeInFrustum(
-                            chunkCenter,
-                            (Chunk::CHUNK_SIZE * Block::BLOCK_RENDER_SIZE) / 2,
-                            (Chunk::CHUNK_SIZE * Block::BLOCK_RENDER_SIZE) / 2,
-                            (Chunk::CHUNK_SIZE * Block::BLOCK_RENDER_SIZE) /
-                                2)) {
-                        continue;
-                    }
-                    chunkRenderList.push_back(pChunk);
-                    // delete pChunk;
-                }
-                // chunkRenderList.push_back(pChunk);
+    // Remove the chunks we got through, the rest are rebuilt next frame
+    chunkRebuildList.erase(chunkRebuildList.begin(), iterator);
+    chunkRebuildList.insert(chunkRebuildList.end(), deferred.begin(),
+                            deferred.end());
+    rebuildCost.add(getFrameElapsedMS() - stageStart, processed);
+}
+
+// build the mesh of chunk on a worker thread, updateUploadList picks it up.
+// With dependencies the borders are only read once they have all finished,
+// otherwise they must already be up to date.
+JobHandle ChunkManager::submitMeshJob(Chunk *chunk,
+                                      const std::vector<JobHandle> &dependencies) {
+    chunk->state = Chunk::STATE_MESHING;
+    meshJobsInFlight++;
+    int mode = Chunk::meshingMode;
+    bool updateBorders = !dependencies.empty();
+    return jobSystem->submit(
+        [this, chunk, mode, updateBorders]() {
+            if (updateBorders) {
+                updateChunkBorders(chunk);
+            }
+            ChunkMesh mesh = {};
+            if (chunk->needsMesh()) {
+                mesh = chunk->buildMesh(mode);
             }
+
+            chunk->state = Chunk::STATE_MESHED;
+            meshUploadQueue.push({chunk, mesh});
+        },
+        dependencies);
+}
+
+// upload finished meshes to the GPU, nearest to the camera first, for as
+// long as the frame budget lasts. A mesh that doesn't fit in the arena is
+// dropped, the chunk keeps what it had and retryDroppedMeshes meshes it
+// again once there may be room.
+void ChunkManager::updateUploadList() {
+    ChunkMeshUpload upload;
+    while (meshUploadQueue.pop(upload)) {
+        chunkUploadList.push_back(upload);
+    }
+    if (chunkUploadList.empty()) {
+        return;
+    }
+    GetMeshArena().maxBytes = (size_t)vramBudgetMB * 1024 * 1024;
+
+    sortByPriority(chunkUploadList,
+                   [](const ChunkMeshUpload &item) { return item.chunk; });
+    double stageStart = getFrameElapsedMS();
+    int processed = 0;
+    std::vector<ChunkMeshUpload>::iterator iterator;
+    for (iterator = chunkUploadList.begin();
+         iterator != chunkUploadList.end() &&
+         hasFrameBudget(uploadCost, processed);
+         ++iterator, processed++) {
+        Chunk *pChunk = iterator->chunk;
+        if (pChunk->uploadMesh(iterator->mesh)) {
+            pChunk->meshDropped = false;
+        } else {
+            FreeChunkMeshData(&iterator->mesh);
+            pChunk->meshDropped = true;
+            meshArenaFull = true;
         }
+        pChunk->state = Chunk::STATE_UPLOADED;
+        updateChunkBounds(pChunk);
+        meshJobsInFlight--;
+        forceVisibilityupdate = true;
     }
+    chunkUploadList.erase(chunkUploadList.begin(), iterator);
+    uploadCost.add(getFrameElapsedMS() - stageStart, processed);
 }
 
-void ChunkManager::updateVisibilityList(glm::vec3 newCameraPosition) {
-    for (Chunk *chunk : chunkVisibilityList) {
-        chunkLoadList.push_back(chunk);
-        // chunkUnloadList.push_back(chunk);
-        chunkSetupList.push_back(chunk);
+double ChunkManager::getFrameElapsedMS() const {
+    std::chrono::duration<double, std::milli> elapsed =
+        std::chrono::steady_clock::now() - frameStart;
+    return elapsed.count();
+}
+
+// whether a stage can take on another item: frameBudgetMS is shared by the
+// stages in the order update runs them, and each stage gets at least one
+// item a frame so none of them starves
+bool ChunkManager::hasFrameBudget(const StageCost &cost, int itemsDone) const {
+    if (itemsDone == 0) {
+        return true;
+    }
+    return getFrameElapsedMS() + cost.itemMS <= frameBudgetMS;
+}
+
+// every UNLOAD_INTERVAL_FRAMES, unload chunks outside chunkGenDistance
+// while the chunks take more than ramBudgetMB or vramBudgetMB, least
+// recently visible first. A mesh that didn't fit in the arena also makes
+// room: the arena is capped at vramBudgetMB, so it can be full below that.
+void ChunkManager::updateUnloadList(glm::vec3 newCameraPosition) {
+    if (frameCount % UNLOAD_INTERVAL_FRAMES != 0) {
+        return;
+    }
+    // give back what the last pass emptied, e.g. after lowering the budget
+    MeshArena &arena = GetMeshArena();
+    arena.shrink();
+
+    std::pair<glm::vec3, glm::vec3> chunkRange =
+        GetChunkGenRange(newCameraPosition);
+    glm::vec3 start = chunkRange.first;
+    glm::vec3 end = chunkRange.second;
+
+    // generated chunks still waiting in chunkSetupList can go too, ones in
+    // generatedQueue can not
+    std::unordered_set<Chunk *> waitingForMesh(chunkSetupList.begin(),
+                                               chunkSetupList.end());
+
+    chunkRamUsage = 0;
+    chunkVramUsage = 0;
+    chunkUnloadList.clear();
+    for (Chunk *pChunk : chunkVisibilityList) {
+        int state = pChunk->state;
+        if (state == Chunk::STATE_REQUESTED ||
+            state == Chunk::STATE_GENERATING) {
+            continue; // blocks may be being written
+        }
+        chunkRamUsage += pChunk->getMemoryUsage();
+        chunkVramUsage += pChunk->getGpuMemoryUsage();
+        // anything else may still be referenced by a job or an event queue
+        if (state != Chunk::STATE_UPLOADED &&
+            !(state == Chunk::STATE_GENERATED &&
+              waitingForMesh.count(pChunk) > 0)) {
+            continue;
+        }
+        // end is exclusive, as in updateAsyncChunker
+        if (!((start.x <= pChunk->chunkPosition.x &&
+               pChunk->chunkPosition.x < end.x) &&
+              (start.y <= pChunk->chunkPosition.y &&
+               pChunk->chunkPosition.y < end.y) &&
+              (start.z <= pChunk->chunkPosition.z &&
+               pChunk->chunkPosition.z < end.z))) {
+            chunkUnloadList.push_back(pChunk);
+        }
+    }
+
+    size_t ramBudget = (size_t)ramBudgetMB * 1024 * 1024;
+    size_t vramBudget = (size_t)vramBudgetMB * 1024 * 1024;
+    if (meshArenaFull) {
+        vramBudget = std::min(vramBudget, arena.getReservedBytes() / 8 * 7);
+        meshArenaFull = false;
+    }
+    bool unloaded = false;
+    if (chunkRamUsage > ramBudget || chunkVramUsage > vramBudget) {
+        std::sort(chunkUnloadList.begin(), chunkUnloadList.end(),
+                  [](const Chunk *a, const Chunk *b) {
+                      return a->lastVisibleFrame < b->lastVisibleFrame;
+                  });
+        for (Chunk *pChunk : chunkUnloadList) {
+            if (chunkRamUsage <= ramBudget && chunkVramUsage <= vramBudget) {
+                break;
+            }
+            chunkRamUsage -= pChunk->getMemoryUsage();
+            chunkVramUsage -= pChunk->getGpuMemoryUsage();
+            unloadChunk(pChunk);
+            unloaded = true;
+        }
+    }
+    chunkUnloadList.clear();
+    if (unloaded) {
+        deleteUnloadingChunks();
+    }
+    retryDroppedMeshes(unloaded);
+}
+
+// send chunks whose mesh didn't fit in the arena back to chunkSetupList,
+// once something was unloaded or the arena can still grow. Until then
+// they are counted in droppedMeshCount.
+void ChunkManager::retryDroppedMeshes(bool unloaded) {
+    bool room = unloaded || GetMeshArena().canGrow();
+    droppedMeshCount = 0;
+    for (Chunk *pChunk : chunkVisibilityList) {
+        if (!pChunk->meshDropped || pChunk->isMeshPending()) {
+            continue;
+        }
+        if (!room) {
+            droppedMeshCount++;
+            continue;
+        }
+        pChunk->meshDropped = false;
+        if (pChunk->rebuildQueued) {
+            chunkRebuildList.erase(std::remove(chunkRebuildList.begin(),
+                                               chunkRebuildList.end(), pChunk),
+                                   chunkRebuildList.end());
+            pChunk->rebuildQueued = false;
+        }
+        pChunk->state = Chunk::STATE_GENERATED;
+        chunkSetupList.push_back(pChunk);
+    }
+}
+
+// drop every STATE_UNLOADING chunk from the lists and delete it
+void ChunkManager::deleteUnloadingChunks() {
+    auto isUnloading = [](Chunk *chunk) {
+        return chunk->state == Chunk::STATE_UNLOADING;
+    };
+    chunkSetupList.erase(std::remove_if(chunkSetupList.begin(),
+                                        chunkSetupList.end(), isUnloading),
+                         chunkSetupList.end());
+    chunkVisibilityList.erase(
+        std::remove_if(chunkVisibilityList.begin(), chunkVisibilityList.end(),
+                       [](Chunk *chunk) {
+                           if (chunk->state != Chunk::STATE_UNLOADING) {
+                               return false;
+                           }
+                           delete chunk;
+                           return true;
+                       }),
+        chunkVisibilityList.end());
+    // last frame's render list may still point at them
+    chunkRenderList.clear();
+}
+
+// take chunk out of the world and free its GL objects, the Chunk itself is
+// deleted by deleteUnloadingChunks. Only for STATE_UPLOADED chunks or generated
+// ones waiting in chunkSetupList: no job or event queue refers to them and
+// neighbour lookups from jobs only happen while pregenerateChunks runs.
+void ChunkManager::unloadChunk(Chunk *chunk) {
+    chunk->state = Chunk::STATE_UNLOADING;
+    {
+        std::lock_guard<std::mutex> lock(*chunkMutex);
+        glm::ivec3 coords = getChunkCoords(chunk->chunkPosition);
+        removeChunk(coords);
+    }
+    if (chunk->rebuildQueued) {
+        chunkRebuildList.erase(std::remove(chunkRebuildList.begin(),
+                                           chunkRebuildList.end(), chunk),
+                               chunkRebuildList.end());
+        chunk->rebuildQueued = false;
+    }
+    chunk->unload();
+    updateChunkBounds(chunk);
+    // the faces its neighbours culled against it are open now
+    QueueNeighboursToRebuild(chunk);
+}
+
+// keep chunk in chunkRegions exactly while it has triangles to draw, after
+// anything that changes its mesh
+void ChunkManager::updateChunkBounds(Chunk *chunk) {
+    bool drawable = chunk->isLoaded() && chunk->isSetup() &&
+                    chunk->mesh.triangleCount > 0;
+    chunk->solidLayers = drawable ? chunk->countSolidLayers() : 0;
+    glm::ivec3 coords = getChunkCoords(chunk->chunkPosition);
+    if (drawable && chunk->boundsIndex < 0) {
+        chunk->boundsIndex = chunkRegions.add(chunk, coords);
+    } else if (!drawable && chunk->boundsIndex >= 0) {
+        Chunk *moved = chunkRegions.remove(coords, chunk->boundsIndex);
+        if (moved != nullptr) {
+            moved->boundsIndex = chunk->boundsIndex;
+        }
+        chunk->boundsIndex = -1;
+    }
+}
+
+// the drawable chunks in render range and in the frustum, culled region by
+// region and then four chunks at a time, see ChunkRegionGrid. Then the ones
+// hidden behind nearer chunks are dropped.
+void ChunkManager::updateRenderList(const Camera &newCamera) {
+    chunkRenderList.clear();
+    std::pair<glm::vec3, glm::vec3> chunkRange =
+        GetChunkRenderRange(newCamera.cameraPos);
+    chunkRegions.cull(newCamera.frustum, chunkRange.first, chunkRange.second,
+                      chunkRenderList);
+    occludedChunkCount = 0;
+    if (occlusionCulling) {
+        cullOccludedChunks(newCamera);
+    }
+    for (Chunk *chunk : chunkRenderList) {
+        chunk->lastVisibleFrame = frameCount;
     }
 }
 
-void ChunkManager::render(Camera newCamera) {
+// draw the solid bottom layers of the nearest MAX_OCCLUDERS chunks in the
+// render list into the OcclusionCuller, and take out the chunks it hides
+void ChunkManager::cullOccludedChunks(const Camera &newCamera) {
+    occluderList.clear();
     for (Chunk *chunk : chunkRenderList) {
-        chunk->render(newCamera);
+        if (chunk->solidLayers > 0) {
+            occluderList.push_back(chunk);
+        }
     }
+    if (occluderList.empty()) {
+        return;
+    }
+
+    constexpr float chunkSize = Chunk::CHUNK_SIZE * Block::BLOCK_RENDER_SIZE;
+    // blocks are centred on their positions, so is the chunk's geometry
+    constexpr float halfBlock = Block::BLOCK_RENDER_SIZE / 2;
+    glm::vec3 centre = newCamera.cameraPos - glm::vec3(chunkSize / 2);
+    auto distance = [centre](const Chunk *chunk) {
+        glm::vec3 offset = chunk->chunkPosition - centre;
+        return glm::dot(offset, offset);
+    };
+    size_t occluderCount =
+        std::min(occluderList.size(), (size_t)MAX_OCCLUDERS);
+    std::partial_sort(occluderList.begin(),
+                      occluderList.begin() + occluderCount, occluderList.end(),
+                      [&distance](const Chunk *a, const Chunk *b) {
+                          return distance(a) < distance(b);
+                      });
+
+    occlusionCuller.begin(newCamera);
+    for (size_t i = 0; i < occluderCount; i++) {
+        Chunk *chunk = occluderList[i];
+        glm::vec3 min = chunk->chunkPosition - glm::vec3(halfBlock);
+        glm::vec3 max =
+            min + glm::vec3(chunkSize,
+                            chunk->solidLayers * Block::BLOCK_RENDER_SIZE,
+                            chunkSize);
+        occlusionCuller.addOccluder(min, max);
+    }
+    occlusionCuller.finish();
+
+    size_t visibleCount = chunkRenderList.size();
+    chunkRenderList.erase(
+        std::remove_if(chunkRenderList.begin(), chunkRenderList.end(),
+                       [this](Chunk *chunk) {
+                           glm::vec3 min =
+                               chunk->chunkPosition - glm::vec3(halfBlock);
+                           return !occlusionCuller.isVisible(
+                               min, min + glm::vec3(chunkSize));
+                       }),
+        chunkRenderList.end());
+    occludedChunkCount = (int)(visibleCount - chunkRenderList.size());
+}
+
+// every visible chunk in one multi-draw from the MeshArena, plus a second
+// one as wireframe when drawWireframe is on. The matrices come from the
+// ViewData uniform block, upload this frame's ViewState first.
+void ChunkManager::render() {
+    renderedTriangleCount = 0;
+    MeshArena &arena = GetMeshArena();
+    arena.clearDraws();
+    for (Chunk *chunk : chunkRenderList) {
+        if (chunk->mesh.arenaPageCount == 0) {
+            continue;
+        }
+        arena.addDraw(chunk->mesh.arenaPage, chunk->mesh.triangleCount * 3);
+        renderedTriangleCount += chunk->mesh.triangleCount;
+    }
+    if (renderedTriangleCount == 0) {
+        return;
+    }
+
+    terrainShader->use();
+    terrainShader->setBool("useInColor", false);
+    arena.draw();
+
+    if (drawWireframe) {
+        // pulled towards the camera so the lines win against the fill
+        terrainShader->setBool("useInColor", true);
+        terrainShader->setVec3("inColor", {0.5f, 1.0f, 0.5f});
+        glEnable(GL_POLYGON_OFFSET_LINE);
+        glPolygonOffset(-1.0f, -1.0f);
+        glPolygonMode(GL_FRONT_AND_BACK, GL_LINE);
+        arena.draw();
+        glPolygonMode(GL_FRONT_AND_BACK, GL_FILL);
+        glDisable(GL_POLYGON_OFFSET_LINE);
+    }
+
+    glUseProgram(0);
 }
 
 #endif // CHUNK_MANAGER
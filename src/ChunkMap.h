@@ -0,0 +1,239 @@
+#ifndef CHUNKMAP_H
+#define CHUNKMAP_H
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+struct Chunk;
+
+/*
+    Open addressing hash map from integer chunk coordinates to chunks.
+
+    Coordinates are packed into one 64-bit key (21 signed bits per axis, so
+    about a million chunks in every direction) and probed linearly.
+
+    One writer at a time (the caller serialises insert and remove), any
+    number of lock-free readers on any thread. Writers publish a slot's
+    value before its key, and grow by rehashing into a table twice the size
+    and publishing that. Readers may still be probing the old table (and see
+    the map as it was when it grew), so retired tables are only freed with
+    the map. Only growing retires a table: tombstones are cleared in place,
+    so churn at a steady size doesn't pile up tables.
+*/
+struct ChunkMap {
+    ChunkMap(size_t initialCapacity = 1024);
+    ~ChunkMap();
+    ChunkMap(const ChunkMap &) = delete;
+    ChunkMap &operator=(const ChunkMap &) = delete;
+
+    Chunk *find(int x, int y, int z) const;
+    void insert(int x, int y, int z, Chunk *chunk);
+    Chunk *remove(int x, int y, int z);
+    size_t size() const { return count; }
+    size_t getCapacity() const { return table.load()->mask + 1; }
+    size_t getRetiredTableCount() const { return retiredTables.size(); }
+
+    static inline uint64_t packKey(int x, int y, int z) {
+        return ((uint64_t)(x & 0x1FFFFF)) | ((uint64_t)(y & 0x1FFFFF) << 21) |
+               ((uint64_t)(z & 0x1FFFFF) << 42);
+    }
+
+  private:
+    // packed keys only use 63 bits
+    static constexpr uint64_t EMPTY_KEY = ~0ull;
+    static constexpr uint64_t TOMBSTONE_KEY = ~0ull - 1;
+
+    struct Slot {
+        std::atomic<uint64_t> key;
+        std::atomic<Chunk *> value;
+    };
+    struct Table {
+        size_t mask; // capacity - 1, capacity is a power of two
+        Slot *slots;
+    };
+
+    std::atomic<Table *> table;
+    std::vector<Table *> retiredTables;
+    size_t count;      // live entries, writer only
+    size_t tombstones; // removed entries still taking up slots, writer only
+
+    static Table *createTable(size_t capacity);
+    static void destroyTable(Table *table);
+    void grow(size_t capacity);
+    void clearTombstones(Table *current, size_t end);
+    void clearAllTombstones(Table *current);
+
+    static inline uint64_t hash(uint64_t key) {
+        // splitmix64 finaliser
+        key ^= key >> 30;
+        key *= 0xbf58476d1ce4e5b9ull;
+        key ^= key >> 27;
+        key *= 0x94d049bb133111ebull;
+        key ^= key >> 31;
+        return key;
+    }
+};
+
+ChunkMap::ChunkMap(size_t initialCapacity) {
+    size_t capacity = 16;
+    while (capacity < initialCapacity) {
+        capacity *= 2;
+    }
+    table = createTable(capacity);
+    count = 0;
+    tombstones = 0;
+}
+
+ChunkMap::~ChunkMap() {
+    destroyTable(table.load());
+    for (Table *retired : retiredTables) {
+        destroyTable(retired);
+    }
+}
+
+ChunkMap::Table *ChunkMap::createTable(size_t capacity) {
+    Table *newTable = new Table();
+    newTable->mask = capacity - 1;
+    newTable->slots = new Slot[capacity];
+    for (size_t i = 0; i < capacity; i++) {
+        newTable->slots[i].key.store(EMPTY_KEY, std::memory_order_relaxed);
+        newTable->slots[i].value.store(nullptr, std::memory_order_relaxed);
+    }
+    return newTable;
+}
+
+void ChunkMap::destroyTable(Table *oldTable) {
+    delete[] oldTable->slots;
+    delete oldTable;
+}
+
+// returns nullptr if there is no chunk at those coordinates
+Chunk *ChunkMap::find(int x, int y, int z) const {
+    uint64_t key = packKey(x, y, z);
+    const Table *current = table.load(std::memory_order_acquire);
+    for (size_t i = hash(key) & current->mask;;
+         i = (i + 1) & current->mask) {
+        uint64_t slotKey = current->slots[i].key.load(std::memory_order_acquire);
+        if (slotKey == key) {
+            return current->slots[i].value.load(std::memory_order_acquire);
+        }
+        if (slotKey == EMPTY_KEY) {
+            return nullptr;
+        }
+    }
+}
+
+// writer only, replaces any chunk already at those coordinates
+void ChunkMap::insert(int x, int y, int z, Chunk *chunk) {
+    Table *current = table.load(std::memory_order_relaxed);
+    // keep probe sequences short, tombstones count against the load too
+    if ((count + tombstones + 1) * 2 > current->mask + 1) {
+        clearAllTombstones(current);
+        if ((count + tombstones + 1) * 2 > current->mask + 1) {
+            grow((current->mask + 1) * 2);
+            current = table.load(std::memory_order_relaxed);
+        }
+    }
+
+    uint64_t key = packKey(x, y, z);
+    size_t firstFree = SIZE_MAX;
+    for (size_t i = hash(key) & current->mask;;
+         i = (i + 1) & current->mask) {
+        uint64_t slotKey = current->slots[i].key.load(std::memory_order_relaxed);
+        if (slotKey == key) {
+            current->slots[i].value.store(chunk, std::memory_order_release);
+            return;
+        }
+        if (slotKey == TOMBSTONE_KEY && firstFree == SIZE_MAX) {
+            firstFree = i;
+        }
+        if (slotKey == EMPTY_KEY) {
+            if (firstFree == SIZE_MAX) {
+                firstFree = i;
+            } else {
+                tombstones--;
+            }
+            break;
+        }
+    }
+    current->slots[firstFree].value.store(chunk, std::memory_order_relaxed);
+    current->slots[firstFree].key.store(key, std::memory_order_release);
+    count++;
+}
+
+// writer only, returns the chunk that was there (or nullptr). Freeing it is
+// up to the caller once no reader can still hold it.
+Chunk *ChunkMap::remove(int x, int y, int z) {
+    uint64_t key = packKey(x, y, z);
+    Table *current = table.load(std::memory_order_relaxed);
+    for (size_t i = hash(key) & current->mask;;
+         i = (i + 1) & current->mask) {
+        uint64_t slotKey = current->slots[i].key.load(std::memory_order_relaxed);
+        if (slotKey == key) {
+            Chunk *chunk = current->slots[i].value.load(std::memory_order_relaxed);
+            current->slots[i].value.store(nullptr, std::memory_order_release);
+            current->slots[i].key.store(TOMBSTONE_KEY, std::memory_order_release);
+            count--;
+            tombstones++;
+            if (current->slots[(i + 1) & current->mask].key.load(
+                    std::memory_order_relaxed) == EMPTY_KEY) {
+                clearTombstones(current, i);
+            }
+            return chunk;
+        }
+        if (slotKey == EMPTY_KEY) {
+            return nullptr;
+        }
+    }
+}
+
+// empty the run of tombstones ending at end. Only safe when the slot after
+// end is empty: no probe goes past an empty slot, so nothing a reader could
+// be looking for lies beyond the run.
+void ChunkMap::clearTombstones(Table *current, size_t end) {
+    for (size_t i = end; current->slots[i].key.load(std::memory_order_relaxed) ==
+                         TOMBSTONE_KEY;
+         i = (i - 1) & current->mask) {
+        current->slots[i].key.store(EMPTY_KEY, std::memory_order_release);
+        tombstones--;
+    }
+}
+
+// clear every run of tombstones that ends at an empty slot, the ones left
+// are between live entries and get reused by inserts
+void ChunkMap::clearAllTombstones(Table *current) {
+    for (size_t i = 0; i <= current->mask && tombstones > 0; i++) {
+        if (current->slots[i].key.load(std::memory_order_relaxed) ==
+            EMPTY_KEY) {
+            clearTombstones(current, (i - 1) & current->mask);
+        }
+    }
+}
+
+// rehash the live entries into a new table and publish it
+void ChunkMap::grow(size_t capacity) {
+    Table *oldTable = table.load(std::memory_order_relaxed);
+    Table *newTable = createTable(capacity);
+    for (size_t i = 0; i <= oldTable->mask; i++) {
+        uint64_t key = oldTable->slots[i].key.load(std::memory_order_relaxed);
+        if (key == EMPTY_KEY || key == TOMBSTONE_KEY) {
+            continue;
+        }
+        size_t j = hash(key) & newTable->mask;
+        while (newTable->slots[j].key.load(std::memory_order_relaxed) !=
+               EMPTY_KEY) {
+            j = (j + 1) & newTable->mask;
+        }
+        newTable->slots[j].value.store(
+            oldTable->slots[i].value.load(std::memory_order_relaxed),
+            std::memory_order_relaxed);
+        newTable->slots[j].key.store(key, std::memory_order_relaxed);
+    }
+    tombstones = 0;
+    table.store(newTable, std::memory_order_release);
+    retiredTables.push_back(oldTable);
+}
+
+#endif // CHUNKMAP_H
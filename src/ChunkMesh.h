@@ -3,12 +3,15 @@
 
 // #include "smolgl.h"
 #include "Camera.h"
+#include "MeshArena.h"
+#include "SlabAllocator.h"
 
 #include <glm/glm.hpp>
 #include <glm/gtc/matrix_transform.hpp>
 #include <glm/gtc/type_ptr.hpp>
 #include <learnopengl/shader_m.h>
 #include <stdlib.h>
+#include <string.h>
 
 #include <stdio.h>
 
@@ -26,7 +29,6 @@ Material::Material() {}
 Material::Material(Shader* _shader) { shader = _shader; }
 
 struct ChunkMesh {
-    static constexpr int MESH_VERTEX_BUFFERS = 2;
     int vertexCount;   // Number of vertices stored in arrays
     int triangleCount; // Number of triangles stored (indexed or not)
 
@@ -36,16 +38,16 @@ struct ChunkMesh {
             [start]...ttttttfffzzzzzzyyyyyyxxxxxx[end]
             where:
             - x, y, z: represent bits occupied to represent vertex position
-   within a chunk
+   within a chunk, Chunk::VERTEX_POSITION_BITS each (6 for 16 block chunks)
             - f: bits occupied to represent the vertex's face's normal vector
             - t: block type ID
     */
-    unsigned int *indices; // Vertex indices (in case vertex data comes indexed)
+    // NOTE: there are no per-mesh indices, every vertex quad is drawn with the
+    // shared quad index buffer (see LoadQuadIndexBuffer)
 
-    // OpenGL identifiers
-    unsigned int vaoId; // OpenGL Vertex Array Object id
-    unsigned int
-        *vboId; // OpenGL Vertex Buffer Objects id (default vertex data)
+    // where the vertices live in the MeshArena, no pages when not uploaded
+    int arenaPage;
+    int arenaPageCount;
 };
 
 struct ChunkModel {
@@ -57,123 +59,38 @@ struct ChunkModel {
     int *meshMaterial;   // Mesh material number
 };
 
-// Upload vertex data into a VAO (if supported) and VBO
-void UploadChunkMesh(ChunkMesh *mesh, bool dynamic) {
-    // printf("Uploading Chunk Mesh...\n");
-    if (mesh->vaoId > 0) {
-        // Check if mesh has already been loaded in GPU
-        // printf("VAO: [ID %i] Trying to re-load an already loaded mesh\n",
-            //    mesh->vaoId);
-        return;
+// Copy the vertex data into the MeshArena, tagged with the chunk's origin.
+// Returns false, leaving the mesh as it was, if the arena is full.
+bool UploadChunkMesh(ChunkMesh *mesh, glm::vec3 origin) {
+    if (mesh->arenaPageCount > 0) {
+        return true; // already uploaded
     }
-
-    mesh->vboId = (unsigned int *)calloc(ChunkMesh::MESH_VERTEX_BUFFERS,
-                                         sizeof(unsigned int));
-
-    mesh->vaoId = 0;    // Vertex Array Object
-    mesh->vboId[0] = 0; // Vertex buffer: positions
-    mesh->vboId[1] = 0; // Vertex buffer: indices
-
-    glGenVertexArrays(1, &(mesh->vaoId));
-    glBindVertexArray(mesh->vaoId);
-
-    // NOTE: Vertex attributes must be uploaded considering default locations
-    // points and available vertex data
-
-    // Enable vertex data: (shader-location = 0)
-    void *vertices = mesh->vertices;
-    mesh->vboId[0] = smolLoadVertexBuffer(
-        vertices, mesh->vertexCount * sizeof(int), dynamic);
-    // TODO: we hardcode this for now...
-    // smolSetVertexAttribute(SMOLGL_DEFAULT_SHADER_ATTRIB_LOCATION_POSITION, 1,
-    //                        GL_INT, 0, 1, 0);
-    glVertexAttribIPointer(SMOLGL_DEFAULT_SHADER_ATTRIB_LOCATION_POSITION, 1,
-                           GL_INT, sizeof(int), (void *)0);
-    smolEnableVertexAttribute(SMOLGL_DEFAULT_SHADER_ATTRIB_LOCATION_POSITION);
-
-    if (mesh->indices != NULL) {
-        // TODO: use unsigned short?
-        mesh->vboId[1] = smolLoadVertexBufferElement(
-            mesh->indices, mesh->triangleCount * 3 * sizeof(unsigned int),
-            dynamic);
-    }
-
-    // if (mesh->vaoId > 0) TRACELOG(LOG_INFO, "VAO: [ID %i] Mesh uploaded
-    // successfully to VRAM (GPU)", mesh->vaoId); else TRACELOG(LOG_INFO, "VBO:
-    // Mesh uploaded successfully to VRAM (GPU)");
-
-    if (mesh->vaoId > 0) {
-        // printf("VAO: [ID %i] Mesh uploaded successfully to VRAM (GPU)\n",
-            //    mesh->vaoId);
-    } else {
-        // printf("VBO: Mesh uploaded successfully to VRAM (GPU)\n");
+    MeshArena &arena = GetMeshArena();
+    int firstPage = arena.allocate(mesh->vertexCount, origin);
+    if (firstPage < 0) {
+        return false;
     }
+    // every mesh shares one quad index buffer, it has to cover this one
+    LoadQuadIndexBuffer(mesh->vertexCount / 4);
+    arena.upload(firstPage, mesh->vertices, mesh->vertexCount);
+    mesh->arenaPage = firstPage;
+    mesh->arenaPageCount = MeshArena::getPageCount(mesh->vertexCount);
+    return true;
+}
 
-    glBindVertexArray(0);
+// Free the CPU side copy of the mesh data, e.g. once it has been uploaded.
+// It comes from SlabAllocator, sized by vertexCount.
+void FreeChunkMeshData(ChunkMesh *mesh) {
+    SlabAllocator::deallocate(mesh->vertices, mesh->vertexCount * sizeof(int));
+    mesh->vertices = NULL;
 }
 
 // Unload mesh from memory (RAM and VRAM)
 void UnloadChunkMesh(ChunkMesh mesh) {
-    // Unload rlgl mesh vboId data
-    smolUnloadVertexArray(mesh.vaoId);
-
-    if (mesh.vboId != NULL)
-        for (int i = 0; i < ChunkMesh::MESH_VERTEX_BUFFERS; i++)
-            glDeleteBuffers(1, &(mesh.vboId[i]));
-    free(mesh.vboId);
-
-    free(mesh.vertices);
-    free(mesh.indices);
-}
-
-void DrawChunkMesh(Camera camera, ChunkMesh mesh, Material material, glm::vec3 position) {
-    material.shader->use();
-
-    glm::mat4 projection = glm::perspective(
-        glm::radians(camera.fov), (float)SCR_WIDTH / SCR_HEIGHT, camera.zNear, camera.zFar);
-    material.shader->setMat4("projection", projection);
-
-    glm::mat4 view = glm::lookAt(camera.cameraPos, camera.cameraPos + camera.cameraFront, camera.cameraUp);
-    material.shader->setMat4("view", view);
-
-    glm::mat4 model = glm::mat4(1.0f);
-    material.shader->setMat4("model", model);
-
-    glBindVertexArray(mesh.vaoId);
-    glBindBuffer(GL_ARRAY_BUFFER, mesh.vboId[0]);
-    glVertexAttribIPointer(SMOLGL_DEFAULT_SHADER_ATTRIB_LOCATION_POSITION, 1,
-                           GL_INT, sizeof(int), (void *)0);
-    smolEnableVertexAttribute(SMOLGL_DEFAULT_SHADER_ATTRIB_LOCATION_POSITION);
-
-    material.shader->setVec3("worldPos", position);
-    // Draw mesh
-    if (mesh.indices != NULL) {
-        material.shader->setBool("useInColor", true);
-        material.shader->setVec3("inColor", {0.5f, 1.0f, 0.5f});
-        glPolygonMode(GL_FRONT_AND_BACK, GL_LINE);
-        smolDrawVertexArrayElements(0, mesh.triangleCount * 3, 0);
-        material.shader->setBool("useInColor", false);
-        glPolygonMode(GL_FRONT_AND_BACK, GL_FILL);
-        smolDrawVertexArrayElements(0, mesh.triangleCount * 3, 0);
+    if (mesh.arenaPageCount > 0) {
+        GetMeshArena().release(mesh.arenaPage, mesh.arenaPageCount);
     }
-    else {
-        material.shader->setBool("useInColor", true);
-        material.shader->setVec3("inColor", {0.5f, 1.0f, 0.5f});
-        glPolygonMode(GL_FRONT_AND_BACK, GL_LINE);
-        smolDrawVertexArray(0, mesh.triangleCount * 3);
-        // material.shader->setVec3("inColor", {0.0f, 0.5f, 0.0f});
-        material.shader->setBool("useInColor", false);
-        glPolygonMode(GL_FRONT_AND_BACK, GL_FILL);
-        smolDrawVertexArray(0, mesh.triangleCount * 3);
-    }
-
-    // Disable all possible vertex array objects (or VBOs)
-    glBindVertexArray(0);
-    glBindBuffer(GL_ARRAY_BUFFER, 0);
-    glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, 0);
-
-    // Disable shader program
-    glUseProgram(0);
+    FreeChunkMeshData(&mesh);
 }
 
 // ChunkModel LoadChunkModelFromMesh(ChunkMesh mesh, Material material) {
@@ -0,0 +1,177 @@
+#ifndef CHUNKRING_H
+#define CHUNKRING_H
+
+#include "ChunkMap.h"
+
+#include <atomic>
+#include <cstdint>
+#include <cstdlib>
+
+struct Chunk;
+
+/*
+    Toroidal grid of the chunks within radius of a centre chunk, in front of
+    a ChunkMap.
+
+    Each axis has a power of two number of slots, at least 2 * radius + 1,
+    and a chunk's slot is its coordinates masked by that, so a lookup is
+    array indexing with no hashing. When the centre moves only the slices
+    that left the window are cleared and the ones that came in are filled
+    from the map, the rest of the chunks keep their slots.
+
+    While a coordinate is inside the window the ring's answer is the whole
+    answer: the owner inserts into and removes from the ring as well as the
+    map. Outside it, ask the map.
+
+    It is only a lookup cache. Slots hold pointers, clearing one doesn't
+    touch the chunk, and chunks are never reused between slots: a chunk
+    that leaves the window stays in the map until it is unloaded, and one
+    that comes in is looked up or created as usual.
+
+    Same threading as ChunkMap: one writer at a time, lock-free readers.
+    recentre and resize move the window, only call them while no other
+    thread is looking chunks up.
+*/
+struct ChunkRing {
+    ChunkRing() = default;
+    ~ChunkRing() { delete[] slots; }
+    ChunkRing(const ChunkRing &) = delete;
+    ChunkRing &operator=(const ChunkRing &) = delete;
+
+    inline bool contains(int x, int y, int z) const {
+        return std::abs(x - centreX) <= radius &&
+               std::abs(y - centreY) <= radius &&
+               std::abs(z - centreZ) <= radius;
+    }
+
+    // only for coordinates inside the window
+    Chunk *find(int x, int y, int z) const;
+    void set(int x, int y, int z, Chunk *chunk);
+
+    void resize(int newRadius, int x, int y, int z, const ChunkMap &map);
+    void recentre(int x, int y, int z, const ChunkMap &map);
+
+  private:
+    struct Slot {
+        std::atomic<uint64_t> key;
+        std::atomic<Chunk *> value;
+    };
+
+    static constexpr uint64_t EMPTY_KEY = ~0ull;
+
+    Slot *slots = nullptr;
+    int bits = 0;    // slots per axis is 1 << bits
+    int radius = -1; // nothing is in the window until resize
+    int centreX = 0;
+    int centreY = 0;
+    int centreZ = 0;
+
+    inline Slot &getSlot(int x, int y, int z) const {
+        int mask = (1 << bits) - 1;
+        return slots[(x & mask) | ((y & mask) << bits) |
+                     ((z & mask) << (bits * 2))];
+    }
+
+    void fill(int x, int y, int z, const ChunkMap &map);
+
+    // calls visit(x, y, z) for every coordinate within radius of (x, y, z)
+    // that is not within radius of (otherX, otherY, otherZ)
+    template <typename Visit>
+    void forEachOnlyIn(int x, int y, int z, int otherX, int otherY,
+                       int otherZ, Visit visit) const;
+};
+
+Chunk *ChunkRing::find(int x, int y, int z) const {
+    uint64_t key = ChunkMap::packKey(x, y, z);
+    const Slot &slot = getSlot(x, y, z);
+    if (slot.key.load(std::memory_order_acquire) != key) {
+        return nullptr;
+    }
+    Chunk *chunk = slot.value.load(std::memory_order_acquire);
+    // the slot may have been reused while the value was read
+    if (slot.key.load(std::memory_order_acquire) != key) {
+        return nullptr;
+    }
+    return chunk;
+}
+
+// writer only, nullptr empties the slot
+void ChunkRing::set(int x, int y, int z, Chunk *chunk) {
+    Slot &slot = getSlot(x, y, z);
+    if (chunk == nullptr) {
+        slot.key.store(EMPTY_KEY, std::memory_order_release);
+        slot.value.store(nullptr, std::memory_order_release);
+        return;
+    }
+    slot.key.store(EMPTY_KEY, std::memory_order_release);
+    slot.value.store(chunk, std::memory_order_release);
+    slot.key.store(ChunkMap::packKey(x, y, z), std::memory_order_release);
+}
+
+void ChunkRing::fill(int x, int y, int z, const ChunkMap &map) {
+    set(x, y, z, map.find(x, y, z));
+}
+
+// new radius and centre, every slot refilled from the map
+void ChunkRing::resize(int newRadius, int x, int y, int z,
+                       const ChunkMap &map) {
+    int newBits = 0;
+    while ((1 << newBits) < newRadius * 2 + 1) {
+        newBits++;
+    }
+    if (newBits != bits || slots == nullptr) {
+        delete[] slots;
+        bits = newBits;
+        slots = new Slot[(size_t)1 << (bits * 3)];
+    }
+    size_t slotCount = (size_t)1 << (bits * 3);
+    for (size_t i = 0; i < slotCount; i++) {
+        slots[i].key.store(EMPTY_KEY, std::memory_order_relaxed);
+        slots[i].value.store(nullptr, std::memory_order_relaxed);
+    }
+    radius = newRadius;
+    centreX = x;
+    centreY = y;
+    centreZ = z;
+    for (int k = z - radius; k <= z + radius; k++) {
+        for (int j = y - radius; j <= y + radius; j++) {
+            for (int i = x - radius; i <= x + radius; i++) {
+                fill(i, j, k, map);
+            }
+        }
+    }
+}
+
+// move the window, only touching the slices that leave and enter it
+void ChunkRing::recentre(int x, int y, int z, const ChunkMap &map) {
+    if (radius < 0) {
+        return;
+    }
+    forEachOnlyIn(centreX, centreY, centreZ, x, y, z,
+                  [this](int i, int j, int k) { set(i, j, k, nullptr); });
+    forEachOnlyIn(x, y, z, centreX, centreY, centreZ,
+                  [this, &map](int i, int j, int k) { fill(i, j, k, map); });
+    centreX = x;
+    centreY = y;
+    centreZ = z;
+}
+
+template <typename Visit>
+void ChunkRing::forEachOnlyIn(int x, int y, int z, int otherX, int otherY,
+                              int otherZ, Visit visit) const {
+    for (int i = x - radius; i <= x + radius; i++) {
+        bool insideX = std::abs(i - otherX) <= radius;
+        for (int j = y - radius; j <= y + radius; j++) {
+            bool insideXY = insideX && std::abs(j - otherY) <= radius;
+            for (int k = z - radius; k <= z + radius; k++) {
+                if (insideXY && std::abs(k - otherZ) <= radius) {
+                    k = otherZ + radius; // skip the overlap
+                    continue;
+                }
+                visit(i, j, k);
+            }
+        }
+    }
+}
+
+#endif // CHUNKRING_H
@@ -0,0 +1,62 @@
+#ifndef EVENTQUEUE_H
+#define EVENTQUEUE_H
+
+#include <atomic>
+
+/*
+    Unbounded lock-free multi-producer single-consumer queue.
+
+    Any thread can push, only one thread (the main thread for the
+    ChunkManager queues) may pop. Pushing is a single atomic exchange, a
+    value pushed while another push is half way through may only show up
+    on a later pop.
+*/
+template <typename T> struct EventQueue {
+    EventQueue() {
+        Node *stub = new Node();
+        stub->next.store(nullptr, std::memory_order_relaxed);
+        head.store(stub, std::memory_order_relaxed);
+        tail = stub;
+    }
+
+    ~EventQueue() {
+        T value;
+        while (pop(value)) {
+        }
+        delete tail;
+    }
+
+    EventQueue(const EventQueue &) = delete;
+    EventQueue &operator=(const EventQueue &) = delete;
+
+    void push(const T &value) {
+        Node *node = new Node();
+        node->value = value;
+        node->next.store(nullptr, std::memory_order_relaxed);
+        Node *prev = head.exchange(node, std::memory_order_acq_rel);
+        prev->next.store(node, std::memory_order_release);
+    }
+
+    // consumer thread only
+    bool pop(T &value) {
+        Node *next = tail->next.load(std::memory_order_acquire);
+        if (next == nullptr) {
+            return false;
+        }
+        value = next->value;
+        delete tail;
+        tail = next; // next becomes the new stub
+        return true;
+    }
+
+  private:
+    struct Node {
+        std::atomic<Node *> next;
+        T value;
+    };
+
+    std::atomic<Node *> head; // last pushed
+    Node *tail;               // stub before the oldest value
+};
+
+#endif // EVENTQUEUE_H
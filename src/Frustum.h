@@ -18,7 +18,7 @@ struct Plane3 {
     Plane3();
     // Plane3(glm::vec3 _normal, glm::vec3 _origin);
     Plane3(const glm::vec3 &p1, const glm::vec3 &norm);
-    float GetPointDistance(glm::vec3 point);
+    float GetPointDistance(glm::vec3 point) const;
 };
 
 Plane3::Plane3() {
@@ -36,7 +36,7 @@ Plane3::Plane3(const glm::vec3 &p1, const glm::vec3 &norm) {
     distance = glm::dot(normal, p1);
 }
 
-float Plane3::GetPointDistance(glm::vec3 point) {
+float Plane3::GetPointDistance(glm::vec3 point) const {
     return glm::dot(point, normal) - distance;
     // float numerator = std::abs((normal.x * point.x + normal.y * point.y +
     //                            normal.z * point.z) + distance);
@@ -54,7 +54,8 @@ struct Frustum {
                    const glm::vec3 &up);
     int PointInFrustum(const glm::vec3 &point);
     int SphereInFrustum(const glm::vec3 &point, float radius);
-    int CubeInFrustum(const glm::vec3 &center, float x, float y, float z);
+    int CubeInFrustum(const glm::vec3 &center, float x, float y,
+                      float z) const;
 
     enum {
         FRUSTUM_TOP = 0,
@@ -99,7 +100,8 @@ int Frustum::SphereInFrustum(const glm::vec3 &point, float radius) {
     return (result);
 }
 
-int Frustum::CubeInFrustum(const glm::vec3 &center, float x, float y, float z) {
+int Frustum::CubeInFrustum(const glm::vec3 &center, float x, float y,
+                           float z) const {
     // NOTE : This code can be optimized, it is just easier to read and
     // understand as is
     int result = FRUSTUM_INSIDE;
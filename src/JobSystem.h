@@ -0,0 +1,243 @@
+#ifndef JOBSYSTEM_H
+#define JOBSYSTEM_H
+
+#include <algorithm>
+#include <atomic>
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+/*
+    Fixed pool of worker threads, one per core, that run small jobs.
+
+    Every worker owns a deque of ready jobs. Jobs submitted from a worker go
+    to the back of its own deque and it pops from the back (most recently
+    submitted, still warm in cache). An idle worker steals from the front of
+    the others. Jobs submitted from any other thread are spread round robin.
+
+    A job can depend on other jobs, it is only queued once all of them have
+    finished. wait() runs queued jobs while it waits, so waiting from a
+    worker (or the main thread) never leaves a core idle.
+*/
+
+typedef std::function<void()> JobFunction;
+
+struct Job {
+    JobFunction function;
+    std::atomic<bool> finished{false};
+
+    // dependencies left before this job can be queued, plus one held by
+    // submit() until it has registered with all of them
+    std::atomic<int> pendingDependencies{1};
+    std::mutex dependentsMutex;
+    std::vector<std::shared_ptr<Job>> dependents; // queued when this finishes
+
+    inline bool isFinished() const { return finished.load(); }
+};
+typedef std::shared_ptr<Job> JobHandle;
+
+struct JobSystem {
+    JobSystem(unsigned int workerCount = 0);
+    ~JobSystem();
+    JobSystem(const JobSystem &) = delete;
+    JobSystem &operator=(const JobSystem &) = delete;
+
+    JobHandle submit(JobFunction function,
+                     const std::vector<JobHandle> &dependencies = {});
+    void wait(const JobHandle &job);
+    void wait(const std::vector<JobHandle> &jobs);
+    void waitIdle();
+    unsigned int getWorkerCount() const { return (unsigned int)workers.size(); }
+
+  private:
+    struct WorkerQueue {
+        std::mutex mutex;
+        std::deque<JobHandle> jobs;
+    };
+
+    std::vector<std::thread> workers;
+    std::vector<std::unique_ptr<WorkerQueue>> queues;
+    std::atomic<unsigned int> nextQueue{0};
+    std::atomic<bool> running{true};
+
+    // sleeping workers wait here until queuedJobs is non zero
+    std::mutex sleepMutex;
+    std::condition_variable sleepCondition;
+    std::atomic<int> queuedJobs{0};
+    // submitted and not finished yet, including jobs waiting on dependencies
+    std::atomic<int> unfinishedJobs{0};
+
+    void enqueue(const JobHandle &job);
+    bool tryRunJob(int preferredQueue);
+    void execute(const JobHandle &job);
+    void workerLoop(int index);
+
+    // index of the worker the calling thread is, -1 for any other thread
+    static int &getWorkerIndex() {
+        static thread_local int workerIndex = -1;
+        return workerIndex;
+    }
+};
+
+JobSystem::JobSystem(unsigned int workerCount) {
+    if (workerCount == 0) {
+        workerCount = std::max(1u, std::thread::hardware_concurrency());
+    }
+    for (unsigned int i = 0; i < workerCount; i++) {
+        queues.push_back(std::unique_ptr<WorkerQueue>(new WorkerQueue()));
+    }
+    for (unsigned int i = 0; i < workerCount; i++) {
+        workers.emplace_back(&JobSystem::workerLoop, this, (int)i);
+    }
+}
+
+// finishes every job before the workers exit
+JobSystem::~JobSystem() {
+    waitIdle();
+    {
+        std::lock_guard<std::mutex> lock(sleepMutex);
+        running = false;
+    }
+    sleepCondition.notify_all();
+    for (std::thread &worker : workers) {
+        worker.join();
+    }
+}
+
+JobHandle JobSystem::submit(JobFunction function,
+                            const std::vector<JobHandle> &dependencies) {
+    JobHandle job = std::make_shared<Job>();
+    job->function = std::move(function);
+    unfinishedJobs++;
+
+    for (const JobHandle &dependency : dependencies) {
+        if (dependency == nullptr) {
+            continue;
+        }
+        std::lock_guard<std::mutex> lock(dependency->dependentsMutex);
+        if (!dependency->isFinished()) {
+            job->pendingDependencies++;
+            dependency->dependents.push_back(job);
+        }
+    }
+    // drop the hold taken at construction
+    if (--job->pendingDependencies == 0) {
+        enqueue(job);
+    }
+    return job;
+}
+
+void JobSystem::enqueue(const JobHandle &job) {
+    int index = getWorkerIndex();
+    if (index < 0) {
+        index = (int)(nextQueue++ % queues.size());
+    }
+    {
+        std::lock_guard<std::mutex> lock(queues[index]->mutex);
+        queues[index]->jobs.push_back(job);
+    }
+    {
+        std::lock_guard<std::mutex> lock(sleepMutex);
+        queuedJobs++;
+    }
+    sleepCondition.notify_one();
+}
+
+// pop from the back of preferredQueue, otherwise steal from the front of
+// another one. Returns false if every queue was empty.
+bool JobSystem::tryRunJob(int preferredQueue) {
+    JobHandle job;
+    if (preferredQueue >= 0) {
+        WorkerQueue &queue = *queues[preferredQueue];
+        std::lock_guard<std::mutex> lock(queue.mutex);
+        if (!queue.jobs.empty()) {
+            job = queue.jobs.back();
+            queue.jobs.pop_back();
+        }
+    }
+    int count = (int)queues.size();
+    int start = preferredQueue >= 0 ? preferredQueue + 1 : 0;
+    for (int i = 0; i < count && job == nullptr; i++) {
+        int victim = (start + i) % count;
+        if (victim == preferredQueue) {
+            continue;
+        }
+        WorkerQueue &queue = *queues[victim];
+        std::lock_guard<std::mutex> lock(queue.mutex);
+        if (!queue.jobs.empty()) {
+            job = queue.jobs.front();
+            queue.jobs.pop_front();
+        }
+    }
+    if (job == nullptr) {
+        return false;
+    }
+    queuedJobs--;
+    execute(job);
+    return true;
+}
+
+void JobSystem::execute(const JobHandle &job) {
+    job->function();
+    job->function = nullptr; // release captures
+
+    std::vector<JobHandle> ready;
+    {
+        std::lock_guard<std::mutex> lock(job->dependentsMutex);
+        job->finished = true;
+        ready.swap(job->dependents);
+    }
+    for (const JobHandle &dependent : ready) {
+        if (--dependent->pendingDependencies == 0) {
+            enqueue(dependent);
+        }
+    }
+    unfinishedJobs--;
+}
+
+void JobSystem::workerLoop(int index) {
+    getWorkerIndex() = index;
+    while (true) {
+        if (tryRunJob(index)) {
+            continue;
+        }
+        std::unique_lock<std::mutex> lock(sleepMutex);
+        sleepCondition.wait(lock, [this]() {
+            return queuedJobs.load() > 0 || !running.load();
+        });
+        if (!running && queuedJobs.load() == 0) {
+            return;
+        }
+    }
+}
+
+// helps with other jobs until job has finished
+void JobSystem::wait(const JobHandle &job) {
+    while (job != nullptr && !job->isFinished()) {
+        if (!tryRunJob(getWorkerIndex())) {
+            std::this_thread::yield();
+        }
+    }
+}
+
+void JobSystem::wait(const std::vector<JobHandle> &jobs) {
+    for (const JobHandle &job : jobs) {
+        wait(job);
+    }
+}
+
+// helps until every submitted job, including ones submitted meanwhile, has
+// finished
+void JobSystem::waitIdle() {
+    while (unfinishedJobs.load() > 0) {
+        if (!tryRunJob(getWorkerIndex())) {
+            std::this_thread::yield();
+        }
+    }
+}
+
+#endif // JOBSYSTEM_H
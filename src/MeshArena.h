@@ -0,0 +1,391 @@
+#ifndef MESHARENA_H
+#define MESHARENA_H
+
+#include "smolgl.h"
+
+#include <glad/glad.h>
+#include <glm/glm.hpp>
+
+#include <algorithm>
+#include <iterator>
+#include <map>
+#include <stdlib.h>
+#include <vector>
+
+// Index buffer holding the v1,v2,v3,v1,v3,v4 pattern of consecutive quads,
+// bound to the MeshArena VAO
+unsigned int quadIndexBufferId = 0;
+int quadIndexBufferCapacity = 0; // in quads
+
+// Make sure the shared quad index buffer covers at least quadCount quads.
+// It grows in place, so the VAOs that already bound it stay valid.
+unsigned int LoadQuadIndexBuffer(int quadCount) {
+    if (quadCount <= quadIndexBufferCapacity) {
+        return quadIndexBufferId;
+    }
+
+    int capacity = quadIndexBufferCapacity > 0 ? quadIndexBufferCapacity : 1024;
+    while (capacity < quadCount) {
+        capacity *= 2;
+    }
+
+    unsigned int *indices =
+        (unsigned int *)malloc(capacity * 6 * sizeof(unsigned int));
+    for (int quad = 0; quad < capacity; quad++) {
+        unsigned int v = quad * 4;
+        indices[quad * 6] = v;
+        indices[quad * 6 + 1] = v + 1;
+        indices[quad * 6 + 2] = v + 2;
+        indices[quad * 6 + 3] = v;
+        indices[quad * 6 + 4] = v + 2;
+        indices[quad * 6 + 5] = v + 3;
+    }
+
+    // don't touch the element binding of whatever VAO is bound
+    glBindVertexArray(0);
+    if (quadIndexBufferId == 0) {
+        glGenBuffers(1, &quadIndexBufferId);
+    }
+    glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, quadIndexBufferId);
+    glBufferData(GL_ELEMENT_ARRAY_BUFFER, capacity * 6 * sizeof(unsigned int),
+                 indices, GL_STATIC_DRAW);
+    glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, 0);
+    free(indices);
+
+    quadIndexBufferCapacity = capacity;
+    return quadIndexBufferId;
+}
+
+/*
+    One GL vertex buffer that every chunk mesh is suballocated from, drawn
+    through a single VAO.
+
+    The buffer is split into pages of PAGE_VERTICES vertices and a mesh takes
+    a run of whole pages, found first fit in a free list of page runs that
+    merges neighbouring runs as they are freed. When nothing fits the buffer
+    doubles, up to maxBytes, and the old contents are copied over on the
+    GPU. shrink() halves it again while the top half is free.
+
+    Vertices only hold their position inside the chunk, so each page's chunk
+    origin is kept in a buffer texture. The base vertex of a draw points at
+    the mesh's first page, which makes gl_VertexID >> PAGE_SHIFT the page in
+    terrain.vert, and lets one glMultiDrawElementsBaseVertex (or
+    glMultiDrawElementsIndirect on GL 4.3) draw every visible chunk.
+*/
+struct MeshArena {
+    static constexpr int PAGE_SHIFT = 7;
+    static constexpr int PAGE_VERTICES = 1 << PAGE_SHIFT;
+    static constexpr int INITIAL_PAGES = 8192; // 4 MB of vertices
+    static constexpr int ORIGIN_TEXTURE_UNIT = 0;
+
+    // layout glMultiDrawElementsIndirect reads
+    struct DrawCommand {
+        GLuint count;
+        GLuint instanceCount;
+        GLuint firstIndex;
+        GLint baseVertex;
+        GLuint baseInstance;
+    };
+
+    static inline int getPageCount(int vertexCount) {
+        return (vertexCount + PAGE_VERTICES - 1) >> PAGE_SHIFT;
+    }
+
+    // the buffer doesn't grow past this, 0 for as far as GL allows
+    size_t maxBytes = 0;
+
+    int allocate(int vertexCount, glm::vec3 origin);
+    void release(int firstPage, int pages);
+    bool shrink();
+    bool canGrow() const { return pageCount < getPageLimit(); }
+    void upload(int firstPage, const int *vertices, int vertexCount);
+
+    // the draw list, build it up then draw() it as many times as needed
+    void clearDraws();
+    void addDraw(int firstPage, int indexCount);
+    void draw();
+
+    size_t getReservedBytes() const {
+        return (size_t)pageCount * PAGE_VERTICES * sizeof(int);
+    }
+    size_t getUsedBytes() const {
+        return (size_t)usedPages * PAGE_VERTICES * sizeof(int);
+    }
+
+  private:
+    unsigned int vaoId = 0;
+    unsigned int vertexBufferId = 0;
+    unsigned int originBufferId = 0; // one vec4 per page
+    unsigned int originTextureId = 0;
+    unsigned int indirectBufferId = 0;
+    int pageCount = 0;
+    int maxPages = 0; // the most the origin buffer texture can hold
+    int usedPages = 0;
+
+    std::map<int, int> freeRuns; // first page -> pages
+    std::vector<glm::vec4> pageOrigins;
+
+    std::vector<GLsizei> drawCounts;
+    std::vector<GLint> drawBaseVertices;
+    std::vector<const void *> drawIndexOffsets; // all 0, the quad indices
+    std::vector<DrawCommand> drawCommands;
+    bool commandsUploaded = false;
+
+    void create();
+    int getPageLimit() const;
+    bool grow(int minPages);
+    void resize(int newPageCount);
+    void addFreeRun(int firstPage, int pages);
+};
+
+// needs a current GL context the first time
+MeshArena &GetMeshArena() {
+    static MeshArena arena;
+    return arena;
+}
+
+void MeshArena::create() {
+    GLint maxTexels = 0;
+    glGetIntegerv(GL_MAX_TEXTURE_BUFFER_SIZE, &maxTexels);
+    maxPages = maxTexels > 0 ? (int)maxTexels : 65536;
+    pageCount = std::min(INITIAL_PAGES, maxPages);
+    pageOrigins.assign(pageCount, glm::vec4(0.0f));
+    addFreeRun(0, pageCount);
+
+    glGenBuffers(1, &vertexBufferId);
+    glBindBuffer(GL_ARRAY_BUFFER, vertexBufferId);
+    glBufferData(GL_ARRAY_BUFFER, getReservedBytes(), NULL, GL_DYNAMIC_DRAW);
+
+    glGenBuffers(1, &originBufferId);
+    glBindBuffer(GL_TEXTURE_BUFFER, originBufferId);
+    glBufferData(GL_TEXTURE_BUFFER, pageCount * sizeof(glm::vec4),
+                 pageOrigins.data(), GL_DYNAMIC_DRAW);
+    glGenTextures(1, &originTextureId);
+    glBindTexture(GL_TEXTURE_BUFFER, originTextureId);
+    glTexBuffer(GL_TEXTURE_BUFFER, GL_RGBA32F, originBufferId);
+    glBindTexture(GL_TEXTURE_BUFFER, 0);
+    glBindBuffer(GL_TEXTURE_BUFFER, 0);
+
+    if (GLAD_GL_VERSION_4_3) {
+        glGenBuffers(1, &indirectBufferId);
+    }
+
+    // every mesh uses the same quad indices, offset by its base vertex
+    unsigned int quadIndexBuffer = LoadQuadIndexBuffer(1);
+    glGenVertexArrays(1, &vaoId);
+    glBindVertexArray(vaoId);
+    glBindBuffer(GL_ARRAY_BUFFER, vertexBufferId);
+    glVertexAttribIPointer(SMOLGL_DEFAULT_SHADER_ATTRIB_LOCATION_POSITION, 1,
+                           GL_INT, sizeof(int), (void *)0);
+    smolEnableVertexAttribute(SMOLGL_DEFAULT_SHADER_ATTRIB_LOCATION_POSITION);
+    glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, quadIndexBuffer);
+    glBindVertexArray(0);
+    glBindBuffer(GL_ARRAY_BUFFER, 0);
+}
+
+// the most pages grow() goes to, by maxBytes and the buffer texture's limit
+int MeshArena::getPageLimit() const {
+    if (maxBytes == 0) {
+        return maxPages;
+    }
+    return (int)std::min<size_t>(
+        maxPages, std::max<size_t>(INITIAL_PAGES,
+                                   maxBytes / (PAGE_VERTICES * sizeof(int))));
+}
+
+// room for at least minPages, returns false at getPageLimit()
+bool MeshArena::grow(int minPages) {
+    int limit = getPageLimit();
+    if (pageCount >= limit) {
+        return false;
+    }
+    int newPageCount = pageCount;
+    while (newPageCount < minPages) {
+        newPageCount *= 2;
+    }
+    newPageCount = std::min(newPageCount, limit);
+    if (newPageCount < minPages) {
+        return false;
+    }
+    addFreeRun(pageCount, newPageCount - pageCount);
+    resize(newPageCount);
+    return true;
+}
+
+// halve the buffer while its top half is free, but not below INITIAL_PAGES.
+// Returns whether it got any smaller.
+bool MeshArena::shrink() {
+    if (freeRuns.empty()) {
+        return false;
+    }
+    std::map<int, int>::iterator last = std::prev(freeRuns.end());
+    if (last->first + last->second != pageCount) {
+        return false; // the last page is in use
+    }
+    int newPageCount = pageCount;
+    while (newPageCount / 2 >= std::max(INITIAL_PAGES, last->first)) {
+        newPageCount /= 2;
+    }
+    if (newPageCount == pageCount) {
+        return false;
+    }
+    if (last->first == newPageCount) {
+        freeRuns.erase(last);
+    } else {
+        last->second = newPageCount - last->first;
+    }
+    resize(newPageCount);
+    return true;
+}
+
+// move to a buffer of newPageCount pages, keeping the pages both have
+void MeshArena::resize(int newPageCount) {
+    int keptPages = std::min(pageCount, newPageCount);
+    unsigned int newVertexBufferId = 0;
+    glGenBuffers(1, &newVertexBufferId);
+    glBindBuffer(GL_COPY_WRITE_BUFFER, newVertexBufferId);
+    glBufferData(GL_COPY_WRITE_BUFFER,
+                 (size_t)newPageCount * PAGE_VERTICES * sizeof(int), NULL,
+                 GL_DYNAMIC_DRAW);
+    glBindBuffer(GL_COPY_READ_BUFFER, vertexBufferId);
+    glCopyBufferSubData(GL_COPY_READ_BUFFER, GL_COPY_WRITE_BUFFER, 0, 0,
+                        (size_t)keptPages * PAGE_VERTICES * sizeof(int));
+    glBindBuffer(GL_COPY_READ_BUFFER, 0);
+    glBindBuffer(GL_COPY_WRITE_BUFFER, 0);
+    glDeleteBuffers(1, &vertexBufferId);
+    vertexBufferId = newVertexBufferId;
+
+    glBindVertexArray(vaoId);
+    glBindBuffer(GL_ARRAY_BUFFER, vertexBufferId);
+    glVertexAttribIPointer(SMOLGL_DEFAULT_SHADER_ATTRIB_LOCATION_POSITION, 1,
+                           GL_INT, sizeof(int), (void *)0);
+    glBindVertexArray(0);
+    glBindBuffer(GL_ARRAY_BUFFER, 0);
+
+    pageOrigins.resize(newPageCount, glm::vec4(0.0f));
+    pageCount = newPageCount;
+
+    glBindBuffer(GL_TEXTURE_BUFFER, originBufferId);
+    glBufferData(GL_TEXTURE_BUFFER, pageCount * sizeof(glm::vec4),
+                 pageOrigins.data(), GL_DYNAMIC_DRAW);
+    glBindBuffer(GL_TEXTURE_BUFFER, 0);
+    glBindTexture(GL_TEXTURE_BUFFER, originTextureId);
+    glTexBuffer(GL_TEXTURE_BUFFER, GL_RGBA32F, originBufferId);
+    glBindTexture(GL_TEXTURE_BUFFER, 0);
+}
+
+// add a run of free pages, merging it with the runs on either side
+void MeshArena::addFreeRun(int firstPage, int pages) {
+    std::map<int, int>::iterator next = freeRuns.lower_bound(firstPage);
+    if (next != freeRuns.end() && firstPage + pages == next->first) {
+        pages += next->second;
+        next = freeRuns.erase(next);
+    }
+    if (next != freeRuns.begin()) {
+        std::map<int, int>::iterator previous = std::prev(next);
+        if (previous->first + previous->second == firstPage) {
+            previous->second += pages;
+            return;
+        }
+    }
+    freeRuns[firstPage] = pages;
+}
+
+// first page of a run big enough for vertexCount vertices whose chunk is at
+// origin, or -1 if the arena is full
+int MeshArena::allocate(int vertexCount, glm::vec3 origin) {
+    if (vaoId == 0) {
+        create();
+    }
+    int pages = getPageCount(vertexCount);
+    std::map<int, int>::iterator run = freeRuns.begin();
+    while (run != freeRuns.end() && run->second < pages) {
+        ++run;
+    }
+    if (run == freeRuns.end()) {
+        if (!grow(pageCount + pages)) {
+            return -1;
+        }
+        return allocate(vertexCount, origin);
+    }
+
+    int firstPage = run->first;
+    int remaining = run->second - pages;
+    freeRuns.erase(run);
+    if (remaining > 0) {
+        freeRuns[firstPage + pages] = remaining;
+    }
+    usedPages += pages;
+
+    for (int page = firstPage; page < firstPage + pages; page++) {
+        pageOrigins[page] = glm::vec4(origin, 1.0f);
+    }
+    glBindBuffer(GL_TEXTURE_BUFFER, originBufferId);
+    glBufferSubData(GL_TEXTURE_BUFFER, firstPage * sizeof(glm::vec4),
+                    pages * sizeof(glm::vec4), &pageOrigins[firstPage]);
+    glBindBuffer(GL_TEXTURE_BUFFER, 0);
+    return firstPage;
+}
+
+void MeshArena::release(int firstPage, int pages) {
+    usedPages -= pages;
+    addFreeRun(firstPage, pages);
+}
+
+void MeshArena::upload(int firstPage, const int *vertices, int vertexCount) {
+    glBindBuffer(GL_ARRAY_BUFFER, vertexBufferId);
+    glBufferSubData(GL_ARRAY_BUFFER,
+                    (size_t)firstPage * PAGE_VERTICES * sizeof(int),
+                    vertexCount * sizeof(int), vertices);
+    glBindBuffer(GL_ARRAY_BUFFER, 0);
+}
+
+void MeshArena::clearDraws() {
+    drawCounts.clear();
+    drawBaseVertices.clear();
+    drawIndexOffsets.clear();
+    drawCommands.clear();
+    commandsUploaded = false;
+}
+
+void MeshArena::addDraw(int firstPage, int indexCount) {
+    GLint baseVertex = firstPage * PAGE_VERTICES;
+    if (indirectBufferId != 0) {
+        drawCommands.push_back({(GLuint)indexCount, 1, 0, baseVertex, 0});
+        return;
+    }
+    drawCounts.push_back(indexCount);
+    drawBaseVertices.push_back(baseVertex);
+    drawIndexOffsets.push_back(NULL);
+}
+
+// one draw call for the whole list, with whatever shader is in use
+void MeshArena::draw() {
+    if (vaoId == 0 || (drawCommands.empty() && drawCounts.empty())) {
+        return;
+    }
+    glActiveTexture(GL_TEXTURE0 + ORIGIN_TEXTURE_UNIT);
+    glBindTexture(GL_TEXTURE_BUFFER, originTextureId);
+    glBindVertexArray(vaoId);
+    if (indirectBufferId != 0) {
+        glBindBuffer(GL_DRAW_INDIRECT_BUFFER, indirectBufferId);
+        if (!commandsUploaded) {
+            glBufferData(GL_DRAW_INDIRECT_BUFFER,
+                         drawCommands.size() * sizeof(DrawCommand),
+                         drawCommands.data(), GL_STREAM_DRAW);
+            commandsUploaded = true;
+        }
+        glMultiDrawElementsIndirect(GL_TRIANGLES, GL_UNSIGNED_INT, (void *)0,
+                                    (GLsizei)drawCommands.size(), 0);
+        glBindBuffer(GL_DRAW_INDIRECT_BUFFER, 0);
+    } else {
+        glMultiDrawElementsBaseVertex(GL_TRIANGLES, drawCounts.data(),
+                                      GL_UNSIGNED_INT, drawIndexOffsets.data(),
+                                      (GLsizei)drawCounts.size(),
+                                      drawBaseVertices.data());
+    }
+    glBindVertexArray(0);
+    glBindTexture(GL_TEXTURE_BUFFER, 0);
+}
+
+#endif // MESHARENA_H
@@ -0,0 +1,306 @@
+#ifndef OCCLUSIONCULLER_H
+#define OCCLUSIONCULLER_H
+
+#include "Camera.h"
+#include "ViewState.h"
+
+#include <algorithm>
+#include <cfloat>
+#include <cmath>
+#include <glm/glm.hpp>
+#include <vector>
+
+#if defined(__SSE__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 1)
+#include <xmmintrin.h>
+#define OCCLUSIONCULLER_SSE 1
+#endif
+
+/*
+    Occlusion culling on the CPU, against a small software depth buffer.
+
+    Occluders are boxes known to be solid all the way through. Their faces
+    towards the camera are rasterised into a WIDTH x HEIGHT buffer of view
+    distances, each face only into texels it covers completely and at the
+    farthest distance of its corners, so an occluder never hides more than
+    the real geometry would. The buffer is then reduced into a pyramid
+    whose texels keep the farthest distance of the four below them.
+
+    A box is hidden when every pyramid texel under its screen rectangle is
+    nearer than the box's nearest corner. The rectangle is taken at the
+    level where it spans at most two texels each way, so a test reads four
+    texels whatever the box's size.
+
+    Per frame: begin(), addOccluder() for each occluder, nearest first,
+    finish(), then isVisible() for anything that passed the frustum test.
+    No GL involved, it runs anywhere.
+*/
+struct OcclusionCuller {
+    static constexpr int WIDTH = 256;
+    static constexpr int HEIGHT = 128;
+    static constexpr int LEVEL_COUNT = 8; // down to 2 x 1
+    // occluders are cut off this far in front of the camera, which keeps
+    // their screen coordinates small enough for float edge functions
+    static constexpr float CLIP_DISTANCE = 1.0f;
+
+    OcclusionCuller();
+
+    void begin(const Camera &camera);
+    void addOccluder(glm::vec3 min, glm::vec3 max);
+    void finish();
+    bool isVisible(glm::vec3 min, glm::vec3 max) const;
+
+  private:
+    glm::mat4 viewProjection;
+    glm::vec3 cameraPosition;
+    float zNear = 0.1f;
+    // levels[0] is the depth buffer, each one after half the size
+    std::vector<float> levels[LEVEL_COUNT];
+
+    static inline int getLevelWidth(int level) {
+        return std::max(1, WIDTH >> level);
+    }
+    static inline int getLevelHeight(int level) {
+        return std::max(1, HEIGHT >> level);
+    }
+
+    // a quad with one corner cut off by the near clip
+    static constexpr int MAX_POLYGON_CORNERS = 5;
+
+    void addQuad(const glm::vec3 corners[4]);
+    void rasterise(const glm::vec2 *screen, int count, float depth);
+};
+
+OcclusionCuller::OcclusionCuller() {
+    for (int level = 0; level < LEVEL_COUNT; level++) {
+        levels[level].assign(getLevelWidth(level) * getLevelHeight(level),
+                             FLT_MAX);
+    }
+}
+
+void OcclusionCuller::begin(const Camera &camera) {
+    ViewState view;
+    view.update(camera);
+    viewProjection = view.uniforms.viewProjection;
+    cameraPosition = camera.cameraPos;
+    zNear = camera.zNear;
+    std::fill(levels[0].begin(), levels[0].end(), FLT_MAX);
+}
+
+// the faces of the box that point towards the camera
+void OcclusionCuller::addOccluder(glm::vec3 min, glm::vec3 max) {
+    glm::vec3 c[8];
+    for (int i = 0; i < 8; i++) {
+        c[i] = glm::vec3(i & 1 ? max.x : min.x, i & 2 ? max.y : min.y,
+                         i & 4 ? max.z : min.z);
+    }
+    if (cameraPosition.x < min.x) {
+        glm::vec3 face[4] = {c[0], c[2], c[6], c[4]};
+        addQuad(face);
+    } else if (cameraPosition.x > max.x) {
+        glm::vec3 face[4] = {c[1], c[5], c[7], c[3]};
+        addQuad(face);
+    }
+    if (cameraPosition.y < min.y) {
+        glm::vec3 face[4] = {c[0], c[4], c[5], c[1]};
+        addQuad(face);
+    } else if (cameraPosition.y > max.y) {
+        glm::vec3 face[4] = {c[2], c[3], c[7], c[6]};
+        addQuad(face);
+    }
+    if (cameraPosition.z < min.z) {
+        glm::vec3 face[4] = {c[0], c[1], c[3], c[2]};
+        addQuad(face);
+    } else if (cameraPosition.z > max.z) {
+        glm::vec3 face[4] = {c[4], c[6], c[7], c[5]};
+        addQuad(face);
+    }
+}
+
+// clip at CLIP_DISTANCE, w is the distance in front of the camera. The
+// quad is rasterised whole rather than as two triangles, which would leave
+// the pixels along their shared edge covered by neither.
+void OcclusionCuller::addQuad(const glm::vec3 corners[4]) {
+    glm::vec4 clip[4];
+    for (int i = 0; i < 4; i++) {
+        clip[i] = viewProjection * glm::vec4(corners[i], 1.0f);
+    }
+
+    float clipDistance = std::max(zNear, CLIP_DISTANCE);
+    glm::vec4 polygon[MAX_POLYGON_CORNERS];
+    int count = 0;
+    for (int i = 0; i < 4; i++) {
+        const glm::vec4 &a = clip[i];
+        const glm::vec4 &b = clip[(i + 1) % 4];
+        bool aInside = a.w >= clipDistance;
+        bool bInside = b.w >= clipDistance;
+        if (aInside) {
+            polygon[count++] = a;
+        }
+        if (aInside != bInside) {
+            float t = (clipDistance - a.w) / (b.w - a.w);
+            polygon[count++] = a + (b - a) * t;
+        }
+    }
+    if (count < 3) {
+        return;
+    }
+
+    glm::vec2 screen[MAX_POLYGON_CORNERS];
+    float depth = 0.0f;
+    for (int i = 0; i < count; i++) {
+        screen[i] = glm::vec2((polygon[i].x / polygon[i].w * 0.5f + 0.5f) * WIDTH,
+                              (polygon[i].y / polygon[i].w * 0.5f + 0.5f) *
+                                  HEIGHT);
+        depth = std::max(depth, polygon[i].w);
+    }
+    rasterise(screen, count, depth);
+}
+
+// write depth into every pixel the convex polygon covers completely, unless
+// something nearer is already there
+void OcclusionCuller::rasterise(const glm::vec2 *screen, int count,
+                                float depth) {
+    float area = 0.0f;
+    glm::vec2 screenMin(FLT_MAX);
+    glm::vec2 screenMax(-FLT_MAX);
+    for (int i = 0; i < count; i++) {
+        const glm::vec2 &from = screen[i];
+        const glm::vec2 &to = screen[(i + 1) % count];
+        area += from.x * to.y - from.y * to.x;
+        screenMin = glm::min(screenMin, from);
+        screenMax = glm::max(screenMax, from);
+    }
+    if (area == 0.0f) {
+        return;
+    }
+    float winding = area > 0.0f ? 1.0f : -1.0f;
+
+    int minX = std::max(0, (int)std::floor(screenMin.x));
+    int maxX = std::min(WIDTH - 1, (int)std::ceil(screenMax.x));
+    int minY = std::max(0, (int)std::floor(screenMin.y));
+    int maxY = std::min(HEIGHT - 1, (int)std::ceil(screenMax.y));
+    if (minX > maxX || minY > maxY) {
+        return;
+    }
+
+    // edge functions e = stepX * x + stepY * y + offset, all >= 0 inside.
+    // Each is pulled in by its value across half a pixel, so testing the
+    // centre tests the pixel's corner that is farthest outside that edge.
+    float stepX[MAX_POLYGON_CORNERS], stepY[MAX_POLYGON_CORNERS],
+        offset[MAX_POLYGON_CORNERS];
+    for (int i = 0; i < count; i++) {
+        const glm::vec2 &from = screen[i];
+        const glm::vec2 &to = screen[(i + 1) % count];
+        stepX[i] = (from.y - to.y) * winding;
+        stepY[i] = (to.x - from.x) * winding;
+        offset[i] = (from.x * to.y - from.y * to.x) * winding -
+                    0.5f * (std::fabs(stepX[i]) + std::fabs(stepY[i]));
+    }
+
+    std::vector<float> &buffer = levels[0];
+    for (int y = minY; y <= maxY; y++) {
+        float centreY = y + 0.5f;
+        float *row = &buffer[y * WIDTH];
+        int x = minX;
+#ifdef OCCLUSIONCULLER_SSE
+        // four pixels at a time from a multiple of four, WIDTH is one too
+        x = minX & ~3;
+        const __m128 depths = _mm_set1_ps(depth);
+        const __m128 zero = _mm_setzero_ps();
+        const __m128 lanes = _mm_set_ps(3.5f, 2.5f, 1.5f, 0.5f);
+        for (; x <= maxX; x += 4) {
+            __m128 centreX = _mm_add_ps(_mm_set1_ps((float)x), lanes);
+            __m128 inside = _mm_cmpeq_ps(zero, zero); // all set
+            for (int i = 0; i < count; i++) {
+                __m128 edge = _mm_add_ps(
+                    _mm_mul_ps(centreX, _mm_set1_ps(stepX[i])),
+                    _mm_set1_ps(stepY[i] * centreY + offset[i]));
+                inside = _mm_and_ps(inside, _mm_cmpge_ps(edge, zero));
+            }
+            __m128 old = _mm_loadu_ps(row + x);
+            __m128 nearer = _mm_min_ps(old, depths);
+            _mm_storeu_ps(row + x, _mm_or_ps(_mm_and_ps(inside, nearer),
+                                             _mm_andnot_ps(inside, old)));
+        }
+#endif
+        for (; x <= maxX; x++) {
+            float centreX = x + 0.5f;
+            bool inside = true;
+            for (int i = 0; i < count; i++) {
+                inside = inside && stepX[i] * centreX + stepY[i] * centreY +
+                                           offset[i] >=
+                                       0.0f;
+            }
+            if (inside) {
+                row[x] = std::min(row[x], depth);
+            }
+        }
+    }
+}
+
+// build the pyramid of farthest distances
+void OcclusionCuller::finish() {
+    for (int level = 1; level < LEVEL_COUNT; level++) {
+        const std::vector<float> &below = levels[level - 1];
+        std::vector<float> &above = levels[level];
+        int belowWidth = getLevelWidth(level - 1);
+        int width = getLevelWidth(level);
+        int height = getLevelHeight(level);
+        for (int y = 0; y < height; y++) {
+            const float *row0 = &below[(y * 2) * belowWidth];
+            const float *row1 = &below[(y * 2 + 1) * belowWidth];
+            for (int x = 0; x < width; x++) {
+                above[y * width + x] =
+                    std::max(std::max(row0[x * 2], row0[x * 2 + 1]),
+                             std::max(row1[x * 2], row1[x * 2 + 1]));
+            }
+        }
+    }
+}
+
+bool OcclusionCuller::isVisible(glm::vec3 min, glm::vec3 max) const {
+    float nearest = FLT_MAX;
+    glm::vec2 screenMin(FLT_MAX);
+    glm::vec2 screenMax(-FLT_MAX);
+    for (int i = 0; i < 8; i++) {
+        glm::vec4 clip =
+            viewProjection * glm::vec4(i & 1 ? max.x : min.x,
+                                       i & 2 ? max.y : min.y,
+                                       i & 4 ? max.z : min.z, 1.0f);
+        if (clip.w < zNear) {
+            return true; // reaches past the camera
+        }
+        glm::vec2 screen((clip.x / clip.w * 0.5f + 0.5f) * WIDTH,
+                         (clip.y / clip.w * 0.5f + 0.5f) * HEIGHT);
+        screenMin = glm::min(screenMin, screen);
+        screenMax = glm::max(screenMax, screen);
+        nearest = std::min(nearest, clip.w);
+    }
+
+    int minX = std::max(0, (int)std::floor(screenMin.x));
+    int maxX = std::min(WIDTH - 1, (int)std::floor(screenMax.x));
+    int minY = std::max(0, (int)std::floor(screenMin.y));
+    int maxY = std::min(HEIGHT - 1, (int)std::floor(screenMax.y));
+    if (minX > maxX || minY > maxY) {
+        return true; // off screen, leave it to the frustum test
+    }
+
+    int level = 0;
+    while (level < LEVEL_COUNT - 1 &&
+           ((maxX >> level) - (minX >> level) > 1 ||
+            (maxY >> level) - (minY >> level) > 1)) {
+        level++;
+    }
+    const std::vector<float> &texels = levels[level];
+    int width = getLevelWidth(level);
+    for (int y = minY >> level; y <= maxY >> level; y++) {
+        for (int x = minX >> level; x <= maxX >> level; x++) {
+            if (texels[y * width + x] >= nearest) {
+                return true;
+            }
+        }
+    }
+    return false;
+}
+
+#endif // OCCLUSIONCULLER_H
@@ -0,0 +1,238 @@
+#ifndef SLABALLOCATOR_H
+#define SLABALLOCATOR_H
+
+#include <algorithm>
+#include <cassert>
+#include <cstddef>
+#include <cstdint>
+#include <mutex>
+#include <stdlib.h>
+#include <vector>
+
+/*
+    Fixed size block pools for what streaming creates and destroys all the
+    time: Chunk objects, block storage and mesh vertex data.
+
+    Blocks are carved out of large slabs that are only given back when the
+    pool goes away, freed blocks go on a free list and are handed out again.
+    Once the pools have warmed up the general purpose heap isn't touched,
+    so it doesn't fragment over a long session.
+
+    Every thread keeps a few free blocks of each pool to itself and only
+    takes the pool's lock to move a batch of them to or from the shared free
+    list, so generator threads don't contend on every allocation.
+*/
+struct SlabPool {
+    static constexpr size_t SLAB_BYTES = 1 << 20;
+    static constexpr size_t CACHE_BYTES = 256 << 10; // per thread
+    static constexpr int MAX_POOLS = 32; // pools that can exist at once
+
+    SlabPool(size_t blockSize);
+    ~SlabPool();
+    SlabPool(const SlabPool &) = delete;
+    SlabPool &operator=(const SlabPool &) = delete;
+
+    void *allocate();
+    void deallocate(void *block);
+    size_t getBlockSize() const { return blockSize; }
+    size_t getReservedBytes();
+    // getReservedBytes summed over every pool
+    static size_t getTotalReservedBytes();
+
+  private:
+    struct FreeBlock {
+        FreeBlock *next;
+    };
+
+    // the calling thread's free blocks of one pool
+    struct ThreadCache {
+        FreeBlock *head = nullptr;
+        size_t count = 0;
+    };
+    struct ThreadCaches {
+        ThreadCache caches[MAX_POOLS];
+        ~ThreadCaches();
+    };
+
+    size_t blockSize;
+    size_t blocksPerSlab;
+    size_t cacheLimit; // blocks a thread keeps before giving some back
+    int id;            // index into ThreadCaches::caches
+
+    std::mutex mutex;
+    FreeBlock *freeList = nullptr;
+    std::vector<void *> slabs;
+
+    void refill(ThreadCache &cache);
+    void flush(ThreadCache &cache, size_t keep);
+
+    static ThreadCache &getThreadCache(int id) {
+        static thread_local ThreadCaches threadCaches;
+        return threadCaches.caches[id];
+    }
+    static SlabPool *&getPool(int id) {
+        static SlabPool *pools[MAX_POOLS] = {nullptr};
+        return pools[id];
+    }
+    static int getNextId() {
+        static std::mutex idMutex;
+        static int nextId = 0;
+        std::lock_guard<std::mutex> lock(idMutex);
+        return nextId++;
+    }
+};
+
+SlabPool::SlabPool(size_t _blockSize) {
+    // room for the free list link, and aligned for anything
+    blockSize = (std::max(_blockSize, sizeof(FreeBlock)) + 15) & ~(size_t)15;
+    blocksPerSlab = std::max<size_t>(1, SLAB_BYTES / blockSize);
+    cacheLimit = std::max<size_t>(2, CACHE_BYTES / blockSize);
+    id = getNextId();
+    assert(id < MAX_POOLS && "Too many SlabPools.");
+    getPool(id) = this;
+}
+
+SlabPool::~SlabPool() {
+    getPool(id) = nullptr;
+    for (void *slab : slabs) {
+        free(slab);
+    }
+}
+
+void *SlabPool::allocate() {
+    ThreadCache &cache = getThreadCache(id);
+    if (cache.head == nullptr) {
+        refill(cache);
+    }
+    FreeBlock *block = cache.head;
+    cache.head = block->next;
+    cache.count--;
+    return block;
+}
+
+void SlabPool::deallocate(void *block) {
+    if (block == nullptr) {
+        return;
+    }
+    ThreadCache &cache = getThreadCache(id);
+    FreeBlock *freed = (FreeBlock *)block;
+    freed->next = cache.head;
+    cache.head = freed;
+    cache.count++;
+    if (cache.count > cacheLimit) {
+        flush(cache, cacheLimit / 2);
+    }
+}
+
+// take half a cache worth of blocks from the shared free list, carving a new
+// slab if it runs out
+void SlabPool::refill(ThreadCache &cache) {
+    std::lock_guard<std::mutex> lock(mutex);
+    size_t wanted = std::max<size_t>(1, cacheLimit / 2);
+    while (cache.count < wanted) {
+        if (freeList == nullptr) {
+            char *slab = (char *)malloc(blockSize * blocksPerSlab);
+            slabs.push_back(slab);
+            for (size_t i = 0; i < blocksPerSlab; i++) {
+                FreeBlock *block = (FreeBlock *)(slab + i * blockSize);
+                block->next = freeList;
+                freeList = block;
+            }
+        }
+        FreeBlock *block = freeList;
+        freeList = block->next;
+        block->next = cache.head;
+        cache.head = block;
+        cache.count++;
+    }
+}
+
+// give all but keep of the cached blocks back to the shared free list
+void SlabPool::flush(ThreadCache &cache, size_t keep) {
+    std::lock_guard<std::mutex> lock(mutex);
+    while (cache.count > keep) {
+        FreeBlock *block = cache.head;
+        cache.head = block->next;
+        block->next = freeList;
+        freeList = block;
+        cache.count--;
+    }
+}
+
+size_t SlabPool::getReservedBytes() {
+    std::lock_guard<std::mutex> lock(mutex);
+    return slabs.size() * blocksPerSlab * blockSize;
+}
+
+size_t SlabPool::getTotalReservedBytes() {
+    size_t total = 0;
+    for (int i = 0; i < MAX_POOLS; i++) {
+        SlabPool *pool = getPool(i);
+        if (pool != nullptr) {
+            total += pool->getReservedBytes();
+        }
+    }
+    return total;
+}
+
+// a thread going away hands its blocks back to pools that still exist
+SlabPool::ThreadCaches::~ThreadCaches() {
+    for (int i = 0; i < MAX_POOLS; i++) {
+        SlabPool *pool = getPool(i);
+        if (pool != nullptr && caches[i].count > 0) {
+            pool->flush(caches[i], 0);
+        }
+    }
+}
+
+// power of two size classes for variable sized data, from 64 bytes up to
+// 64 KB. Anything bigger goes to malloc: blocks are never given back to the
+// heap, and a pool of big blocks would keep a slab's worth of each size
+// that was ever needed.
+struct SlabAllocator {
+    static constexpr int MIN_SIZE_CLASS = 6;
+    static constexpr int MAX_SIZE_CLASS = 16;
+
+    static void *allocate(size_t size) {
+        int sizeClass = getSizeClass(size);
+        if (sizeClass > MAX_SIZE_CLASS) {
+            return malloc(size);
+        }
+        return getClassPool(sizeClass).allocate();
+    }
+
+    // size must be what was asked of allocate
+    static void deallocate(void *block, size_t size) {
+        if (block == nullptr) {
+            return;
+        }
+        int sizeClass = getSizeClass(size);
+        if (sizeClass > MAX_SIZE_CLASS) {
+            free(block);
+            return;
+        }
+        getClassPool(sizeClass).deallocate(block);
+    }
+
+  private:
+    static int getSizeClass(size_t size) {
+        int sizeClass = MIN_SIZE_CLASS;
+        while (((size_t)1 << sizeClass) < size) {
+            sizeClass++;
+        }
+        return sizeClass;
+    }
+
+    static SlabPool &getClassPool(int sizeClass) {
+        static SlabPool *pools[MAX_SIZE_CLASS + 1] = {nullptr};
+        static std::once_flag created;
+        std::call_once(created, []() {
+            for (int i = MIN_SIZE_CLASS; i <= MAX_SIZE_CLASS; i++) {
+                pools[i] = new SlabPool((size_t)1 << i);
+            }
+        });
+        return *pools[sizeClass];
+    }
+};
+
+#endif // SLABALLOCATOR_H
@@ -0,0 +1,155 @@
+#ifndef TERRAINGENERATOR_H
+#define TERRAINGENERATOR_H
+
+#include "Block.h"
+
+#include <cmath>
+#include <cstdint>
+
+/*
+    Seeded heightmap terrain.
+
+    Everything is derived from the seed and the block's world coordinates by
+    hashing, there are no permutation tables or rand() state, so any thread
+    generates the same chunk for the same seed and position.
+
+    Heights come from fractal (fBm) gradient noise over x and z. Below the
+    surface are a few blocks of dirt and then stone, columns whose top is
+    under SEA_LEVEL are filled up with water.
+*/
+struct TerrainGenerator {
+    // heights are in blocks, the world only has chunks below y = 0
+    static constexpr int BASE_HEIGHT = -64;
+    static constexpr int HEIGHT_AMPLITUDE = 40;
+    static constexpr int SEA_LEVEL = -70;
+    static constexpr int DIRT_DEPTH = 3;
+    static constexpr int OCTAVES = 5;
+    static constexpr float FREQUENCY = 1.0f / 128.0f;
+
+    uint32_t seed;
+
+    explicit TerrainGenerator(uint32_t _seed) : seed(_seed) {}
+
+    // surface height of one column, in world block coordinates
+    int getHeight(int x, int z) const;
+
+    // fill SIZE^3 blocks starting at the given world block coordinates,
+    // indexed x + y * SIZE + z * SIZE * SIZE like Chunk::getIndex
+    template <int SIZE>
+    void generateChunk(int originX, int originY, int originZ,
+                       Block *out) const;
+
+  private:
+    static inline uint32_t hash(uint32_t seed, int x, int z) {
+        uint32_t h = seed ^ ((uint32_t)x * 0x27d4eb2du) ^
+                     ((uint32_t)z * 0x165667b1u);
+        h ^= h >> 15;
+        h *= 0x2c1b3c6du;
+        h ^= h >> 12;
+        h *= 0x297a2d39u;
+        h ^= h >> 15;
+        return h;
+    }
+
+    // dot product of the corner's pseudo random gradient with (dx, dz)
+    static inline float gradient(uint32_t seed, int x, int z, float dx,
+                                 float dz) {
+        uint32_t h = hash(seed, x, z);
+        float gx = (h & 1) ? 1.0f : -1.0f;
+        float gz = (h & 2) ? 1.0f : -1.0f;
+        // axis aligned or diagonal
+        if (h & 4) {
+            return (h & 8) ? gx * dx : gz * dz;
+        }
+        return (gx * dx + gz * dz) * 0.7071f;
+    }
+
+    static inline float fade(float t) {
+        return t * t * t * (t * (t * 6.0f - 15.0f) + 10.0f);
+    }
+
+    static float noise(uint32_t seed, float x, float z);
+    float fbm(float x, float z) const;
+};
+
+// 2D gradient noise, roughly in [-1, 1]
+float TerrainGenerator::noise(uint32_t seed, float x, float z) {
+    float fx = std::floor(x);
+    float fz = std::floor(z);
+    int ix = (int)fx;
+    int iz = (int)fz;
+    float dx = x - fx;
+    float dz = z - fz;
+
+    float n00 = gradient(seed, ix, iz, dx, dz);
+    float n10 = gradient(seed, ix + 1, iz, dx - 1.0f, dz);
+    float n01 = gradient(seed, ix, iz + 1, dx, dz - 1.0f);
+    float n11 = gradient(seed, ix + 1, iz + 1, dx - 1.0f, dz - 1.0f);
+
+    float u = fade(dx);
+    float v = fade(dz);
+    float nx0 = n00 + u * (n10 - n00);
+    float nx1 = n01 + u * (n11 - n01);
+    return (nx0 + v * (nx1 - nx0)) * 1.4142f;
+}
+
+// octaves of noise, each at twice the frequency and half the amplitude of
+// the last and with its own seed
+float TerrainGenerator::fbm(float x, float z) const {
+    float sum = 0.0f;
+    float amplitude = 1.0f;
+    float frequency = FREQUENCY;
+    float total = 0.0f;
+    for (int octave = 0; octave < OCTAVES; octave++) {
+        uint32_t octaveSeed = seed + (uint32_t)octave * 0x9e3779b9u;
+        sum += noise(octaveSeed, x * frequency, z * frequency) * amplitude;
+        total += amplitude;
+        amplitude *= 0.5f;
+        frequency *= 2.0f;
+    }
+    return sum / total;
+}
+
+int TerrainGenerator::getHeight(int x, int z) const {
+    return BASE_HEIGHT + (int)std::floor(fbm((float)x, (float)z) *
+                                         (float)HEIGHT_AMPLITUDE);
+}
+
+template <int SIZE>
+void TerrainGenerator::generateChunk(int originX, int originY, int originZ,
+                                     Block *out) const {
+    // the noise is only evaluated once per column
+    int heights[SIZE * SIZE];
+    for (int z = 0; z < SIZE; z++) {
+        for (int x = 0; x < SIZE; x++) {
+            heights[x + z * SIZE] = getHeight(originX + x, originZ + z);
+        }
+    }
+
+    for (int z = 0; z < SIZE; z++) {
+        for (int y = 0; y < SIZE; y++) {
+            int worldY = originY + y;
+            Block *row = out + y * SIZE + z * SIZE * SIZE;
+            const int *rowHeights = heights + z * SIZE;
+            for (int x = 0; x < SIZE; x++) {
+                int height = rowHeights[x];
+                BlockType type = BlockType::Default;
+                if (worldY < height - DIRT_DEPTH) {
+                    type = BlockType::Stone;
+                } else if (worldY < height) {
+                    type = BlockType::Dirt;
+                } else if (worldY == height) {
+                    // beaches around the water
+                    type = height <= SEA_LEVEL + 1 ? BlockType::Sand
+                                                   : BlockType::Grass;
+                } else if (worldY <= SEA_LEVEL) {
+                    type = BlockType::Water;
+                }
+                row[x].isActive = type != BlockType::Default;
+                row[x].blockType = type;
+            }
+        }
+    }
+}
+
+#endif // TERRAINGENERATOR_H
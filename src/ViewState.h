@@ -0,0 +1,72 @@
+#ifndef VIEWSTATE_H
+#define VIEWSTATE_H
+
+#include "Camera.h"
+
+#include <glad/glad.h>
+#include <glm/glm.hpp>
+#include <glm/gtc/matrix_transform.hpp>
+#include <learnopengl/shader_m.h>
+
+/*
+    What every draw in a frame needs to know about the camera, worked out
+    once per frame and handed to the shaders in a uniform buffer bound to
+    the ViewData block, so no draw has to set its own matrices.
+*/
+struct ViewState {
+    static constexpr unsigned int UNIFORM_BINDING = 0;
+
+    // std140 layout of the ViewData block
+    struct Uniforms {
+        glm::mat4 projection;
+        glm::mat4 view;
+        glm::mat4 viewProjection;
+        glm::vec4 cameraPosition; // w unused
+    };
+
+    Uniforms uniforms;
+
+    // matrices for this frame's camera, then upload() them
+    void update(const Camera &camera);
+    void upload();
+
+    // point a shader's ViewData block at the shared buffer, once per program
+    static void bindShader(const Shader &shader);
+
+  private:
+    unsigned int uniformBufferId = 0;
+};
+
+void ViewState::update(const Camera &camera) {
+    uniforms.projection = glm::perspective(glm::radians(camera.fov),
+                                           (float)SCR_WIDTH / SCR_HEIGHT,
+                                           camera.zNear, camera.zFar);
+    uniforms.view = glm::lookAt(camera.cameraPos,
+                                camera.cameraPos + camera.cameraFront,
+                                camera.cameraUp);
+    uniforms.viewProjection = uniforms.projection * uniforms.view;
+    uniforms.cameraPosition = glm::vec4(camera.cameraPos, 1.0f);
+}
+
+// needs a current GL context
+void ViewState::upload() {
+    if (uniformBufferId == 0) {
+        glGenBuffers(1, &uniformBufferId);
+        glBindBuffer(GL_UNIFORM_BUFFER, uniformBufferId);
+        glBufferData(GL_UNIFORM_BUFFER, sizeof(Uniforms), NULL,
+                     GL_DYNAMIC_DRAW);
+        glBindBufferBase(GL_UNIFORM_BUFFER, UNIFORM_BINDING, uniformBufferId);
+    }
+    glBindBuffer(GL_UNIFORM_BUFFER, uniformBufferId);
+    glBufferSubData(GL_UNIFORM_BUFFER, 0, sizeof(Uniforms), &uniforms);
+    glBindBuffer(GL_UNIFORM_BUFFER, 0);
+}
+
+void ViewState::bindShader(const Shader &shader) {
+    unsigned int blockIndex = glGetUniformBlockIndex(shader.ID, "ViewData");
+    if (blockIndex != GL_INVALID_INDEX) {
+        glUniformBlockBinding(shader.ID, blockIndex, UNIFORM_BINDING);
+    }
+}
+
+#endif // VIEWSTATE_H
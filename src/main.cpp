@@ -13,6 +13,7 @@
 
 #include "Ecs.h"
 #include "PhysicsSystem.h"
+#include "ViewState.h"
 
 #include <iostream>
 #include "utils.h"
@@ -113,6 +114,14 @@ int main() {
         new Shader("src/shaders/terrain.vert", "src/shaders/terrain.frag");
     Shader *defaultShader =
         new Shader("src/shaders/shader.vert", "src/shaders/shader.frag");
+    ourShader->use();
+    ourShader->setInt("positionBits", Chunk::VERTEX_POSITION_BITS);
+    ourShader->setInt("positionOffset", Chunk::VERTEX_POSITION_OFFSET);
+    ourShader->setInt("chunkOrigins", MeshArena::ORIGIN_TEXTURE_UNIT);
+    ourShader->setInt("pageShift", MeshArena::PAGE_SHIFT);
+    ViewState::bindShader(*ourShader);
+    ViewState::bindShader(*defaultShader);
+    ViewState viewState;
 
     // glm::vec3 pos = glm::vec3(0, 0, 0);
     // Chunk chunk = Chunk(pos, ourShader);
@@ -191,7 +200,9 @@ int main() {
         Transform playerTrans = gCoordinator.GetComponent<Transform>(player);
 
         // render
-        gCoordinator.mChunkManager->render(gCoordinator.mCamera);
+        viewState.update(gCoordinator.mCamera);
+        viewState.upload();
+        gCoordinator.mChunkManager->render();
         
         // TODO: render the "player" entity
         defaultShader->use();
@@ -216,6 +227,27 @@ int main() {
         ImGui::Begin("Stats", &active, statsFlags);
         ImGui::Text("%s", fpsStr);
         ImGui::Text("%s", memStr);
+        ImGui::Text("Triangles: %d",
+                    gCoordinator.mChunkManager->renderedTriangleCount);
+        ImGui::Text("Occluded chunks: %d",
+                    gCoordinator.mChunkManager->occludedChunkCount);
+        ImGui::Text("Chunks: %d (%.1f MB payload, %.1f MB VRAM)",
+                    (int)gCoordinator.mChunkManager->chunks.size(),
+                    gCoordinator.mChunkManager->chunkRamUsage / 1048576.0f,
+                    gCoordinator.mChunkManager->chunkVramUsage / 1048576.0f);
+        ImGui::Text("Slab pools: %.1f MB reserved",
+                    SlabPool::getTotalReservedBytes() / 1048576.0f);
+        ImGui::Text("Mesh arena: %.1f MB used of %.1f MB VRAM (max %d MB)",
+                    GetMeshArena().getUsedBytes() / 1048576.0f,
+                    GetMeshArena().getReservedBytes() / 1048576.0f,
+                    gCoordinator.mChunkManager->vramBudgetMB);
+        if (gCoordinator.mChunkManager->droppedMeshCount > 0) {
+            ImGui::Text("Mesh arena full: %d chunks not drawn",
+                        gCoordinator.mChunkManager->droppedMeshCount);
+        }
+        ImGui::Text("Speed: %.0f (generating %.0f chunks/s)",
+                    glm::length(gCoordinator.mChunkManager->cameraVelocity),
+                    gCoordinator.mChunkManager->generateRate);
         ImGui::Separator();
         // Ends the window
         ImGui::End();
@@ -292,6 +324,16 @@ int main() {
             // Text that appears in the window
             ImGui::Checkbox("generate chunks",
                             &gCoordinator.mChunkManager->genChunk);
+            ImGui::Checkbox("wireframe",
+                            &gCoordinator.mChunkManager->drawWireframe);
+            ImGui::Checkbox("occlusion culling",
+                            &gCoordinator.mChunkManager->occlusionCulling);
+            ImGui::LabelText("##meshingModeLabel", "Meshing");
+            if (ImGui::Combo("##meshingModeCombo", &Chunk::meshingMode,
+                             Chunk::meshingModeNames,
+                             Chunk::MESHING_MODE_COUNT)) {
+                gCoordinator.mChunkManager->QueueAllChunksToRebuild();
+            }
             ImGui::LabelText("##moveSpeedLabel", "Movement Speed");
             ImGui::SliderFloat("##moveSpeedSlider",
                                &gCoordinator.mCamera.cameraSpeedMultiplier,
@@ -305,6 +347,20 @@ int main() {
                 "##renderDistanceSlider",
                 (int *)&(gCoordinator.mChunkManager->chunkRenderDistance), 1,
                 16);
+            ImGui::LabelText("##frameBudgetLabel", "Chunk Work Per Frame (ms)");
+            ImGui::SliderFloat("##frameBudgetSlider",
+                               &gCoordinator.mChunkManager->frameBudgetMS,
+                               0.5f, 16.0f);
+            ImGui::LabelText("##ramBudgetLabel",
+                             "Chunk RAM Budget (MB, chunk payload)");
+            ImGui::SliderInt("##ramBudgetSlider",
+                             &gCoordinator.mChunkManager->ramBudgetMB, 16,
+                             4096);
+            ImGui::LabelText("##vramBudgetLabel",
+                             "Chunk VRAM Budget (MB, caps the mesh arena)");
+            ImGui::SliderInt("##vramBudgetSlider",
+                             &gCoordinator.mChunkManager->vramBudgetMB, 16,
+                             4096);
             ImGui::LabelText("##zFarLabel", "zFar");
             ImGui::SliderFloat("##zFarSlider", &gCoordinator.mCamera.zFar, 1.0f,
                                2000.0f);
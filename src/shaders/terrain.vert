@@ -6,26 +6,45 @@ out vec3 ourColor;
 
 uniform vec3 inColor;
 uniform bool useInColor;
-uniform vec3 worldPos;
-uniform mat4 model;
-uniform mat4 view;
-uniform mat4 projection;
+// chunk origin of every MeshArena page, see MeshArena.h
+uniform samplerBuffer chunkOrigins;
+uniform int pageShift;
+// per frame camera state, see ViewState.h
+layout (std140) uniform ViewData {
+    mat4 projection;
+    mat4 view;
+    mat4 viewProjection;
+    vec4 cameraPosition;
+};
+// vertex packing, see Chunk::packVertex
+uniform int positionBits;
+uniform int positionOffset;
 
-const vec3 colors[3] = vec3[](vec3(0.0, 0.0, 0.0), vec3(0.0, 0.5, 0.0), vec3(0.5, 0.5, 0.0));
+// indexed by BlockType
+const vec3 colors[7] = vec3[](vec3(0.0, 0.0, 0.0), // Default
+                              vec3(0.0, 0.5, 0.0), // Grass
+                              vec3(0.5, 0.5, 0.0), // Sand
+                              vec3(0.4, 0.25, 0.1), // Dirt
+                              vec3(0.1, 0.3, 0.7), // Water
+                              vec3(0.45, 0.45, 0.45), // Stone
+                              vec3(0.35, 0.2, 0.05)); // Wood
 
 void main()
 {
-    int offset = 16; // Offset to revert the signed range
+    int mask = (1 << positionBits) - 1;
 
     // Decode the 32-bit integer into x, y, z positions
-    float x = ((vertexPosition & 0x3F) - offset);         // 6 bits for x
-    float y = (((vertexPosition >> 6) & 0x3F) - offset);  // 6 bits for y
-    float z = (((vertexPosition >> 12) & 0x3F) - offset); // 6 bits for z
-    int colorPos = (((vertexPosition >> 21) & 0x3F)); // 6 bits for texture
+    float x = ((vertexPosition & mask) - positionOffset);
+    float y = (((vertexPosition >> positionBits) & mask) - positionOffset);
+    float z = (((vertexPosition >> (positionBits * 2)) & mask) - positionOffset);
+    // 3 normal bits follow the position, then the block type
+    int colorPos = ((vertexPosition >> (positionBits * 3 + 3)) & 0x3F);
     // No normal or type used in this example for movement
     vec3 decodedPos = vec3(x, y, z);
 
-    gl_Position = projection * view * model * vec4(decodedPos + worldPos, 1.0);
+    // gl_VertexID counts from the start of the arena, base vertex included
+    vec3 worldPos = texelFetch(chunkOrigins, gl_VertexID >> pageShift).xyz;
+    gl_Position = viewProjection * vec4(decodedPos + worldPos, 1.0);
     // TexCoord = vec2(0.0, 0.0); // Assuming no texture coordinates for simplicity
     if (!useInColor) {
         ourColor = colors[colorPos];
@@ -0,0 +1,89 @@
+// ChunkMap under insert/remove churn: stays correct, and its memory stays
+// bounded when the number of live chunks doesn't grow
+
+#include "ChunkMap.h"
+
+#include <cstdio>
+#include <cstdlib>
+#include <random>
+#include <unordered_map>
+
+#define CHECK(condition)                                                       \
+    do {                                                                       \
+        if (!(condition)) {                                                    \
+            printf("%s:%d: check failed: %s\n", __FILE__, __LINE__,            \
+                   #condition);                                                \
+            exit(1);                                                           \
+        }                                                                      \
+    } while (0)
+
+// never dereferenced, only compared
+static Chunk *fakeChunk(int i) { return (Chunk *)(uintptr_t)((i + 1) * 16); }
+
+// the same few chunks loaded and unloaded over and over, e.g. flying back
+// and forth across a chunk border
+static void testSteadyChurn() {
+    ChunkMap map;
+    size_t capacity = map.getCapacity();
+    for (int cycle = 0; cycle < 100000; cycle++) {
+        for (int i = 0; i < 64; i++) {
+            map.insert(cycle, i, 0, fakeChunk(i));
+        }
+        for (int i = 0; i < 64; i++) {
+            CHECK(map.remove(cycle, i, 0) == fakeChunk(i));
+        }
+    }
+    CHECK(map.size() == 0);
+    CHECK(map.getCapacity() == capacity);
+    CHECK(map.getRetiredTableCount() == 0);
+}
+
+struct Entry {
+    int x, y, z;
+    Chunk *chunk;
+};
+
+// random inserts and removes, checked against std::unordered_map
+static void testRandomChurn() {
+    ChunkMap map;
+    std::unordered_map<uint64_t, Entry> expected;
+    std::mt19937 random(1234);
+    std::uniform_int_distribution<int> coordinate(-40, 40);
+    size_t largestSize = 0;
+    for (int step = 0; step < 500000; step++) {
+        int x = coordinate(random);
+        int y = coordinate(random) / 8;
+        int z = coordinate(random);
+        uint64_t key = ChunkMap::packKey(x, y, z);
+        if (random() % 2 == 0) {
+            map.insert(x, y, z, fakeChunk(step));
+            expected[key] = {x, y, z, fakeChunk(step)};
+        } else {
+            auto found = expected.find(key);
+            Chunk *removed = map.remove(x, y, z);
+            CHECK(removed == (found == expected.end() ? nullptr
+                                                      : found->second.chunk));
+            if (found != expected.end()) {
+                expected.erase(found);
+            }
+        }
+        largestSize = std::max(largestSize, map.size());
+        CHECK(map.size() == expected.size());
+    }
+    for (const auto &[key, entry] : expected) {
+        CHECK(map.find(entry.x, entry.y, entry.z) == entry.chunk);
+    }
+    // growing only ever doubles past what the live chunks need
+    size_t bound = 16;
+    while (bound < largestSize * 4) {
+        bound *= 2;
+    }
+    CHECK(map.getCapacity() <= bound);
+}
+
+int main() {
+    testSteadyChurn();
+    testRandomChurn();
+    printf("ChunkMap tests passed\n");
+    return 0;
+}
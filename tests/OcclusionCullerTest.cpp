@@ -0,0 +1,230 @@
+// OcclusionCuller must be conservative: anything it reports hidden has to be
+// hidden for real. Checked by brute force against random scenes of boxes,
+// casting rays from the camera to points all over each hidden box.
+
+#include "smolgl.h"
+
+#include "OcclusionCuller.h"
+
+#include <cstdio>
+#include <cstdlib>
+#include <random>
+#include <vector>
+
+#define CHECK(condition)                                                       \
+    do {                                                                       \
+        if (!(condition)) {                                                    \
+            printf("%s:%d: check failed: %s\n", __FILE__, __LINE__,            \
+                   #condition);                                                \
+            exit(1);                                                           \
+        }                                                                      \
+    } while (0)
+
+struct Box {
+    glm::vec3 min, max;
+};
+
+// does the segment from start towards end cross the box before reaching end
+static bool segmentHitsBox(glm::vec3 start, glm::vec3 end, const Box &box) {
+    glm::vec3 direction = end - start;
+    float enter = 0.0f;
+    float exit = 0.999f;
+    for (int axis = 0; axis < 3; axis++) {
+        if (std::fabs(direction[axis]) < 1e-9f) {
+            if (start[axis] < box.min[axis] || start[axis] > box.max[axis]) {
+                return false;
+            }
+            continue;
+        }
+        float near = (box.min[axis] - start[axis]) / direction[axis];
+        float far = (box.max[axis] - start[axis]) / direction[axis];
+        if (near > far) {
+            std::swap(near, far);
+        }
+        enter = std::max(enter, near);
+        exit = std::min(exit, far);
+        if (enter > exit) {
+            return false;
+        }
+    }
+    return true;
+}
+
+static bool isOnScreen(const glm::mat4 &viewProjection, glm::vec3 point) {
+    glm::vec4 clip = viewProjection * glm::vec4(point, 1.0f);
+    return clip.w > 0.1f && std::fabs(clip.x) <= clip.w &&
+           std::fabs(clip.y) <= clip.w;
+}
+
+static Camera makeCamera(glm::vec3 position, glm::vec3 front) {
+    Camera camera;
+    camera.cameraPos = position;
+    camera.cameraFront = glm::normalize(front);
+    camera.cameraUp = glm::vec3(0.0f, 1.0f, 0.0f);
+    return camera;
+}
+
+// a wall straight in front of the camera
+static void testWall() {
+    OcclusionCuller culler;
+    culler.begin(makeCamera({0, 0, 0}, {0, 0, -1}));
+    culler.addOccluder({-50, -50, -20}, {50, 50, -18});
+    culler.finish();
+    CHECK(!culler.isVisible({-5, -5, -40}, {5, 5, -30}));   // behind it
+    CHECK(culler.isVisible({-1, -1, -10}, {1, 1, -8}));     // in front
+    CHECK(culler.isVisible({-5, 45, -40}, {5, 80, -30}));   // over the top
+    CHECK(culler.isVisible({200, 0, -100}, {210, 10, -90})); // beside it
+}
+
+static bool isBlocked(glm::vec3 start, glm::vec3 end,
+                      const std::vector<Box> &occluders) {
+    for (const Box &occluder : occluders) {
+        if (segmentHitsBox(start, end, occluder)) {
+            return true;
+        }
+    }
+    return false;
+}
+
+// tiny boxes swept across a wall's edge in steps much finer than a pixel,
+// the pixels along the edge are only partly covered by the wall
+static void testEdges() {
+    std::mt19937 random(3);
+    std::uniform_real_distribution<float> unit(-1.0f, 1.0f);
+    OcclusionCuller culler;
+    int hidden = 0;
+    int wronglyHidden = 0;
+    for (int scene = 0; scene < 50; scene++) {
+        glm::vec3 position(0, 0, 0);
+        Camera camera = makeCamera(position, {unit(random) * 0.2f,
+                                              unit(random) * 0.2f, -1});
+        std::vector<Box> occluders = {
+            {{-100, -100, -20}, {unit(random) * 5, unit(random) * 5, -18}}};
+        culler.begin(camera);
+        culler.addOccluder(occluders[0].min, occluders[0].max);
+        culler.finish();
+
+        // behind the wall's top right corner, 3x as far from the camera.
+        // Odd scenes sweep across the right edge, even ones the top.
+        glm::vec3 corner = occluders[0].max * glm::vec3(3, 3, 1) +
+                           glm::vec3(0, 0, -36);
+        for (int step = -200; step <= 200; step++) {
+            glm::vec3 centre = corner + glm::vec3(step * 0.01f,
+                                                  unit(random) * 10 - 12, 0);
+            if (scene % 2 == 0) {
+                centre = corner + glm::vec3(unit(random) * 10 - 12,
+                                            step * 0.01f, 0);
+            }
+            glm::vec3 halfSize(0.01f);
+            Box target = {centre - halfSize, centre + halfSize};
+            if (culler.isVisible(target.min, target.max)) {
+                continue;
+            }
+            hidden++;
+            for (int sample = 0; sample < 8; sample++) {
+                glm::vec3 point(sample & 1 ? target.max.x : target.min.x,
+                                sample & 2 ? target.max.y : target.min.y,
+                                sample & 4 ? target.max.z : target.min.z);
+                if (!isBlocked(position, point, occluders)) {
+                    wronglyHidden++;
+                    break;
+                }
+            }
+        }
+    }
+    CHECK(hidden > 0);
+    CHECK(wronglyHidden == 0);
+}
+
+// random occluders, and random boxes behind them down to well under a
+// pixel across, so partly covered pixels at the occluders' edges count
+static void testConservative() {
+    std::mt19937 random(7);
+    std::uniform_real_distribution<float> unit(-1.0f, 1.0f);
+    OcclusionCuller culler;
+    int tested = 0;
+    int hidden = 0;
+    int wronglyHidden = 0;
+    for (int scene = 0; scene < 100; scene++) {
+        glm::vec3 position(unit(random) * 10, unit(random) * 10,
+                           unit(random) * 10);
+        glm::vec3 front(unit(random), unit(random) * 0.5f, unit(random));
+        Camera camera = makeCamera(position, front);
+        front = camera.cameraFront;
+        ViewState view;
+        view.update(camera);
+        const glm::mat4 &viewProjection = view.uniforms.viewProjection;
+
+        std::vector<Box> occluders;
+        culler.begin(camera);
+        for (int i = 0; i < 40; i++) {
+            glm::vec3 centre = position + front * (20 + 60 * (unit(random) + 1)) +
+                               glm::vec3(unit(random), unit(random),
+                                         unit(random)) *
+                                   60.0f;
+            glm::vec3 halfSize(4 + 20 * (unit(random) + 1),
+                               4 + 20 * (unit(random) + 1),
+                               4 + 20 * (unit(random) + 1));
+            Box box = {centre - halfSize, centre + halfSize};
+            if (position.x > box.min.x - 1 && position.x < box.max.x + 1 &&
+                position.y > box.min.y - 1 && position.y < box.max.y + 1 &&
+                position.z > box.min.z - 1 && position.z < box.max.z + 1) {
+                continue; // camera inside it
+            }
+            occluders.push_back(box);
+            culler.addOccluder(box.min, box.max);
+        }
+        culler.finish();
+
+        for (int i = 0; i < 200; i++) {
+            glm::vec3 centre = position + front * (30 + 200 * (unit(random) + 1)) +
+                               glm::vec3(unit(random), unit(random),
+                                         unit(random)) *
+                                   150.0f;
+            glm::vec3 halfSize(i % 2 == 0 ? 16.0f : 0.1f + unit(random) + 1);
+            Box target = {centre - halfSize, centre + halfSize};
+            tested++;
+            if (culler.isVisible(target.min, target.max)) {
+                continue;
+            }
+            hidden++;
+
+            // corners, then random points on the faces
+            bool seen = false;
+            for (int sample = 0; sample < 2008 && !seen; sample++) {
+                glm::vec3 point;
+                if (sample < 8) {
+                    point = glm::vec3(sample & 1 ? target.max.x : target.min.x,
+                                      sample & 2 ? target.max.y : target.min.y,
+                                      sample & 4 ? target.max.z : target.min.z);
+                } else {
+                    glm::vec3 t((unit(random) + 1) / 2, (unit(random) + 1) / 2,
+                                (unit(random) + 1) / 2);
+                    point = target.min + (target.max - target.min) * t;
+                    int axis = random() % 3;
+                    point[axis] =
+                        random() % 2 ? target.max[axis] : target.min[axis];
+                }
+                if (!isOnScreen(viewProjection, point)) {
+                    continue;
+                }
+                seen = !isBlocked(position, point, occluders);
+            }
+            if (seen) {
+                wronglyHidden++;
+            }
+        }
+    }
+    printf("tested %d, hidden %d, wrongly hidden %d\n", tested, hidden,
+           wronglyHidden);
+    CHECK(hidden > tested / 4); // it does hide things
+    CHECK(wronglyHidden == 0);
+}
+
+int main() {
+    testWall();
+    testEdges();
+    testConservative();
+    printf("OcclusionCuller tests passed\n");
+    return 0;
+}